@@ -2,6 +2,8 @@
 
 #include <array>
 
+#include "bitboard.h"
+
 namespace flare {
 namespace {
 
@@ -131,4 +133,81 @@ bool IsSquareAttacked(const Position& position, Square square, Color by_color) {
 	return false;
 }
 
+void ComputeAttackInfo(const Position& position, AttackInfo& info) {
+	Bitboard occupancy = position.all_occupancy_bb_;
+	for (int color_index = 0; color_index < kColorCount; ++color_index) {
+		Color color = static_cast<Color>(color_index);
+		Bitboard attacked = 0;
+		Bitboard double_attacked = 0;
+		for (int type_index = ToIndex(PieceType::kPawn); type_index <= ToIndex(PieceType::kKing);
+			++type_index) {
+			PieceType type = static_cast<PieceType>(type_index);
+			Bitboard by_type = 0;
+			Bitboard pieces = position.piece_bb_[color_index][type_index];
+			while (pieces) {
+				Square square = static_cast<Square>(PopLsb(pieces));
+				Bitboard attacks = 0;
+				switch (type) {
+					case PieceType::kPawn:
+						attacks = PawnAttacks(color, square);
+						break;
+					case PieceType::kKnight:
+						attacks = KnightAttacks(square);
+						break;
+					case PieceType::kBishop:
+						attacks = BishopAttacks(square, occupancy);
+						break;
+					case PieceType::kRook:
+						attacks = RookAttacks(square, occupancy);
+						break;
+					case PieceType::kQueen:
+						attacks = QueenAttacks(square, occupancy);
+						break;
+					case PieceType::kKing:
+						attacks = KingAttacks(square);
+						break;
+					case PieceType::kNone:
+						break;
+				}
+				info.by_square[ToIndex(square)] = attacks;
+				double_attacked |= attacked & attacks;
+				attacked |= attacks;
+				by_type |= attacks;
+			}
+			info.by_type[color_index][type_index] = by_type;
+		}
+		info.attacked[color_index] = attacked;
+		info.double_attacked[color_index] = double_attacked;
+	}
+
+	for (int color_index = 0; color_index < kColorCount; ++color_index) {
+		Color color = static_cast<Color>(color_index);
+		int them = ToIndex(OppositeColor(color));
+		info.king_danger[color_index] = info.attacked[them];
+		Square king_square = position.KingSquare(color);
+		if (king_square == Square::kNoSquare || !HasBit(info.attacked[them], king_square)) {
+			continue;
+		}
+		// Only a slider already hitting the king has its ray changed by lifting it.
+		Bitboard without_king = occupancy & ~SquareBit(king_square);
+		Bitboard diagonal = position.piece_bb_[them][ToIndex(PieceType::kBishop)] |
+			position.piece_bb_[them][ToIndex(PieceType::kQueen)];
+		Bitboard straight = position.piece_bb_[them][ToIndex(PieceType::kRook)] |
+			position.piece_bb_[them][ToIndex(PieceType::kQueen)];
+		Bitboard checkers = diagonal | straight;
+		while (checkers) {
+			Square square = static_cast<Square>(PopLsb(checkers));
+			if (!HasBit(info.by_square[ToIndex(square)], king_square)) {
+				continue;
+			}
+			if (HasBit(diagonal, square)) {
+				info.king_danger[color_index] |= BishopAttacks(square, without_king);
+			}
+			if (HasBit(straight, square)) {
+				info.king_danger[color_index] |= RookAttacks(square, without_king);
+			}
+		}
+	}
+}
+
 }
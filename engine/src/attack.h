@@ -1,9 +1,24 @@
 #pragma once
 
+#include <array>
+
 #include "position.h"
 
 namespace flare {
 
+// Attack maps for both sides, built once per node and shared by the evaluation and move
+// generation.
+struct AttackInfo {
+	// Squares attacked by the piece standing on each square.
+	std::array<Bitboard, kSquareCount> by_square{};
+	std::array<std::array<Bitboard, kPieceTypeCount>, kColorCount> by_type{};
+	std::array<Bitboard, kColorCount> attacked{};
+	std::array<Bitboard, kColorCount> double_attacked{};
+	// Squares each side's king may not step to: the enemy attacks with that king lifted off
+	// the board, so checking sliders see through it.
+	std::array<Bitboard, kColorCount> king_danger{};
+};
+
 Bitboard PawnAttacks(Color color, Square square);
 Bitboard KnightAttacks(Square square);
 Bitboard KingAttacks(Square square);
@@ -11,6 +26,7 @@ Bitboard BishopAttacks(Square square, Bitboard occupancy);
 Bitboard RookAttacks(Square square, Bitboard occupancy);
 Bitboard QueenAttacks(Square square, Bitboard occupancy);
 bool IsSquareAttacked(const Position& position, Square square, Color by_color);
+void ComputeAttackInfo(const Position& position, AttackInfo& info);
 
 }
 
@@ -0,0 +1,386 @@
+#include "endgame.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+
+#include "attack.h"
+#include "bitboard.h"
+#include "psqt.h"
+#include "zobrist.h"
+
+namespace flare {
+namespace {
+
+constexpr Bitboard kDarkSquares = 0xaa55aa55aa55aa55ULL;
+constexpr int kOppositeBishopsScale = 16;
+
+// KPK positions are indexed with white holding the pawn on files a-d.
+constexpr int kKpkSize = 2 * 24 * kSquareCount * kSquareCount;
+
+enum KpkResult : std::uint8_t {
+	kKpkInvalid = 0,
+	kKpkUnknown = 1,
+	kKpkDraw = 2,
+	kKpkWin = 4,
+};
+
+int KpkIndex(Color side_to_move, Square weak_king, Square strong_king, Square pawn) {
+	int pawn_index = (RankOf(pawn) - 1) * 4 + FileOf(pawn);
+	return ToIndex(strong_king) | ToIndex(weak_king) << 6 | ToIndex(side_to_move) << 12 |
+		pawn_index << 13;
+}
+
+int Distance(Square first, Square second) {
+	return std::max(std::abs(FileOf(first) - FileOf(second)),
+		std::abs(RankOf(first) - RankOf(second)));
+}
+
+int RelativeRank(Color color, Square square) {
+	return color == Color::kWhite ? RankOf(square) : kRankCount - 1 - RankOf(square);
+}
+
+Square PieceSquare(const Position& position, Color color, PieceType type) {
+	return static_cast<Square>(LsbIndex(position.piece_bb_[ToIndex(color)][ToIndex(type)]));
+}
+
+int Count(const Position& position, Color color, PieceType type) {
+	return std::popcount(position.piece_bb_[ToIndex(color)][ToIndex(type)]);
+}
+
+int NonPawnMaterial(const Position& position, Color color) {
+	int material = 0;
+	for (int type_index = ToIndex(PieceType::kKnight); type_index <= ToIndex(PieceType::kQueen);
+		++type_index) {
+		material += kPieceValueMidgame[type_index] *
+			std::popcount(position.piece_bb_[ToIndex(color)][type_index]);
+	}
+	return material;
+}
+
+int EndgameMaterial(const Position& position, Color color) {
+	int material = 0;
+	for (int type_index = ToIndex(PieceType::kPawn); type_index <= ToIndex(PieceType::kQueen);
+		++type_index) {
+		material += kPieceValueEndgame[type_index] *
+			std::popcount(position.piece_bb_[ToIndex(color)][type_index]);
+	}
+	return material;
+}
+
+// Grows as the king nears the edge, and as the two kings close in on each other.
+int PushToEdge(Square square) {
+	int file = FileOf(square);
+	int rank = RankOf(square);
+	return 20 * (std::max(3 - file, file - 4) + std::max(3 - rank, rank - 4));
+}
+
+int PushClose(Square first, Square second) {
+	return 70 - 10 * Distance(first, second);
+}
+
+// Mating material against a bare king: drive it to the edge with our king alongside.
+int EvaluateKxk(const Position& position, Color strong) {
+	Color weak = OppositeColor(strong);
+	Square strong_king = position.KingSquare(strong);
+	Square weak_king = position.KingSquare(weak);
+	int score = EndgameMaterial(position, strong) + PushToEdge(weak_king) +
+		PushClose(strong_king, weak_king);
+	Bitboard bishops = position.piece_bb_[ToIndex(strong)][ToIndex(PieceType::kBishop)];
+	if (Count(position, strong, PieceType::kQueen) || Count(position, strong, PieceType::kRook) ||
+		(bishops && Count(position, strong, PieceType::kKnight)) ||
+		((bishops & kDarkSquares) && (bishops & ~kDarkSquares))) {
+		score += kKnownWin;
+	}
+	return score;
+}
+
+// Bishop and knight mate only in a corner of the bishop's colour.
+int EvaluateKbnk(const Position& position, Color strong) {
+	Color weak = OppositeColor(strong);
+	Square strong_king = position.KingSquare(strong);
+	Square weak_king = position.KingSquare(weak);
+	Square bishop = PieceSquare(position, strong, PieceType::kBishop);
+	// Mirror light-squared bishops so the target corners are always a1 and h8.
+	Square corner_king = HasBit(kDarkSquares, bishop)
+		? weak_king : static_cast<Square>(ToIndex(weak_king) ^ 7);
+	int corner_distance =
+		std::min(Distance(corner_king, Square::kA1), Distance(corner_king, Square::kH8));
+	return kKnownWin + EndgameMaterial(position, strong) + PushClose(strong_king, weak_king) +
+		PushToEdge(weak_king) + 40 * (7 - corner_distance);
+}
+
+int EvaluateKpk(const Position& position, Color strong) {
+	Color weak = OppositeColor(strong);
+	Square pawn = PieceSquare(position, strong, PieceType::kPawn);
+	if (!Endgames::Instance().ProbeKpk(strong, position.KingSquare(strong), pawn,
+		position.KingSquare(weak), position.side_to_move_)) {
+		return 0;
+	}
+	return kKnownWin + kPieceValueEndgame[ToIndex(PieceType::kPawn)] +
+		10 * RelativeRank(strong, pawn);
+}
+
+PieceType PieceTypeFromCode(char piece) {
+	switch (piece) {
+		case 'P':
+			return PieceType::kPawn;
+		case 'N':
+			return PieceType::kKnight;
+		case 'B':
+			return PieceType::kBishop;
+		case 'R':
+			return PieceType::kRook;
+		case 'Q':
+			return PieceType::kQueen;
+		case 'K':
+			return PieceType::kKing;
+		default:
+			return PieceType::kNone;
+	}
+}
+
+int EvaluateDraw(const Position&, Color) {
+	return 0;
+}
+
+// A rook pawn whose promotion square the bishop does not cover is a draw once the defending
+// king reaches the corner.
+int ScaleKbpk(const Position& position, Color strong) {
+	Square pawn = PieceSquare(position, strong, PieceType::kPawn);
+	if (FileOf(pawn) != 0 && FileOf(pawn) != kFileCount - 1) {
+		return kScaleNormal;
+	}
+	Square promotion = MakeSquare(FileOf(pawn), strong == Color::kWhite ? kRankCount - 1 : 0);
+	Square bishop = PieceSquare(position, strong, PieceType::kBishop);
+	if (HasBit(kDarkSquares, bishop) != HasBit(kDarkSquares, promotion) &&
+		Distance(position.KingSquare(OppositeColor(strong)), promotion) <= 1) {
+		return 0;
+	}
+	return kScaleNormal;
+}
+
+}
+
+std::uint64_t MaterialKey(std::string_view code, Color strong) {
+	const auto& zobrist = Zobrist::Instance();
+	std::array<std::array<int, kPieceTypeCount>, kColorCount> counts{};
+	std::size_t weak_start = code.find('K', 1);
+	for (std::size_t index = 0; index < code.size(); ++index) {
+		Color color = index < weak_start ? strong : OppositeColor(strong);
+		PieceType type = PieceTypeFromCode(code[index]);
+		if (type != PieceType::kNone) {
+			++counts[ToIndex(color)][ToIndex(type)];
+		}
+	}
+	std::uint64_t key = 0;
+	for (Color color : {Color::kWhite, Color::kBlack}) {
+		for (int type_index = ToIndex(PieceType::kPawn); type_index <= ToIndex(PieceType::kKing);
+			++type_index) {
+			Piece piece = MakePiece(color, static_cast<PieceType>(type_index));
+			for (int index = 0; index < counts[ToIndex(color)][type_index]; ++index) {
+				key ^= zobrist.Material()[ToIndex(piece)][index];
+			}
+		}
+	}
+	return key;
+}
+
+Endgames::Endgames() {
+	Add("KK", EvaluateDraw, nullptr);
+	Add("KNK", EvaluateDraw, nullptr);
+	Add("KBK", EvaluateDraw, nullptr);
+	Add("KNNK", EvaluateDraw, nullptr);
+	Add("KPK", EvaluateKpk, nullptr);
+	Add("KBNK", EvaluateKbnk, nullptr);
+	Add("KBPK", nullptr, ScaleKbpk);
+	lone_king_[ToIndex(Color::kWhite)] = {EvaluateKxk, nullptr, Color::kWhite};
+	lone_king_[ToIndex(Color::kBlack)] = {EvaluateKxk, nullptr, Color::kBlack};
+	GenerateKpk();
+}
+
+const Endgames& Endgames::Instance() {
+	static Endgames instance;
+	return instance;
+}
+
+void Endgames::Add(std::string_view code, EndgameFunction evaluate, ScaleFunction scale) {
+	for (Color strong : {Color::kWhite, Color::kBlack}) {
+		entries_.emplace(MaterialKey(code, strong), EndgameEntry{evaluate, scale, strong});
+	}
+	max_entry_pieces_ = std::max(max_entry_pieces_, static_cast<int>(code.size()));
+}
+
+const EndgameEntry* Endgames::Find(const Position& position) const {
+	if (std::popcount(position.all_occupancy_bb_) > max_entry_pieces_) {
+		return nullptr;
+	}
+	auto it = entries_.find(position.material_key_);
+	return it == entries_.end() ? nullptr : &it->second;
+}
+
+const EndgameEntry* Endgames::FindEvaluation(const Position& position) const {
+	const EndgameEntry* entry = Find(position);
+	if (entry && entry->evaluate) {
+		return entry;
+	}
+	for (Color strong : {Color::kWhite, Color::kBlack}) {
+		Color weak = OppositeColor(strong);
+		if (position.occupancy_bb_[ToIndex(weak)] ==
+			position.piece_bb_[ToIndex(weak)][ToIndex(PieceType::kKing)] &&
+			std::popcount(position.occupancy_bb_[ToIndex(weak)]) == 1 &&
+			position.KingSquare(strong) != Square::kNoSquare &&
+			NonPawnMaterial(position, strong) >= kPieceValueMidgame[ToIndex(PieceType::kRook)]) {
+			return &lone_king_[ToIndex(strong)];
+		}
+	}
+	return nullptr;
+}
+
+bool Endgames::Evaluate(const Position& position, int& score) const {
+	const EndgameEntry* entry = FindEvaluation(position);
+	if (!entry) {
+		return false;
+	}
+	score = entry->evaluate(position, entry->strong);
+	if (position.side_to_move_ != entry->strong) {
+		score = -score;
+	}
+	return true;
+}
+
+bool Endgames::HasEvaluation(const Position& position) const {
+	return FindEvaluation(position) != nullptr;
+}
+
+int Endgames::Scale(const Position& position, Color strong) const {
+	const EndgameEntry* entry = Find(position);
+	if (entry && entry->scale && entry->strong == strong) {
+		return entry->scale(position, strong);
+	}
+	Color weak = OppositeColor(strong);
+	int strong_material = NonPawnMaterial(position, strong);
+	int weak_material = NonPawnMaterial(position, weak);
+	int bishop_value = kPieceValueMidgame[ToIndex(PieceType::kBishop)];
+	// Without pawns, a minor piece up or less is not enough to win.
+	if (!Count(position, strong, PieceType::kPawn) &&
+		strong_material - weak_material <= bishop_value) {
+		return strong_material < kPieceValueMidgame[ToIndex(PieceType::kRook)] ? 0 : 4;
+	}
+	Bitboard bishops = position.piece_bb_[0][ToIndex(PieceType::kBishop)] |
+		position.piece_bb_[1][ToIndex(PieceType::kBishop)];
+	if (strong_material == bishop_value && weak_material == bishop_value &&
+		std::popcount(bishops) == 2 && std::popcount(bishops & kDarkSquares) == 1) {
+		return kOppositeBishopsScale;
+	}
+	return kScaleNormal;
+}
+
+bool Endgames::ProbeKpk(Color strong, Square strong_king, Square pawn, Square weak_king,
+	Color side_to_move) const {
+	// Normalise to white holding the pawn on files a-d.
+	int flip = strong == Color::kWhite ? 0 : 56;
+	int mirror = FileOf(pawn) >= kFileCount / 2 ? 7 : 0;
+	auto normalise = [flip, mirror](Square square) {
+		return static_cast<Square>(ToIndex(square) ^ flip ^ mirror);
+	};
+	Color relative = side_to_move == strong ? Color::kWhite : Color::kBlack;
+	int index = KpkIndex(relative, normalise(weak_king), normalise(strong_king), normalise(pawn));
+	return (kpk_wins_[index >> 6] >> (index & 63)) & 1;
+}
+
+// Retrograde classification: seed mates-in-promotion, stalemates and lost pawns, then
+// propagate until no position changes. White wins if any move wins; black draws if any
+// move draws.
+void Endgames::GenerateKpk() {
+	std::vector<std::uint8_t> results(kKpkSize, kKpkUnknown);
+	auto decode = [](int index, Color& side_to_move, Square& weak_king, Square& strong_king,
+		Square& pawn) {
+		strong_king = static_cast<Square>(index & 63);
+		weak_king = static_cast<Square>((index >> 6) & 63);
+		side_to_move = static_cast<Color>((index >> 12) & 1);
+		int pawn_index = index >> 13;
+		pawn = MakeSquare(pawn_index % 4, pawn_index / 4 + 1);
+	};
+
+	for (int index = 0; index < kKpkSize; ++index) {
+		Color side_to_move;
+		Square weak_king;
+		Square strong_king;
+		Square pawn;
+		decode(index, side_to_move, weak_king, strong_king, pawn);
+		Bitboard pawn_attacks = PawnAttacks(Color::kWhite, pawn);
+		Square push = static_cast<Square>(ToIndex(pawn) + kFileCount);
+		if (Distance(strong_king, weak_king) <= 1 || strong_king == pawn || weak_king == pawn ||
+			(side_to_move == Color::kWhite && HasBit(pawn_attacks, weak_king))) {
+			results[index] = kKpkInvalid;
+		} else if (side_to_move == Color::kWhite && RankOf(pawn) == kRankCount - 2 &&
+			strong_king != push && weak_king != push &&
+			(Distance(weak_king, push) > 1 || Distance(strong_king, push) == 1)) {
+			results[index] = kKpkWin;
+		} else if (side_to_move == Color::kBlack &&
+			(!(KingAttacks(weak_king) & ~(KingAttacks(strong_king) | pawn_attacks)) ||
+				(KingAttacks(weak_king) & SquareBit(pawn) & ~KingAttacks(strong_king)))) {
+			results[index] = kKpkDraw;
+		}
+	}
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int index = 0; index < kKpkSize; ++index) {
+			if (results[index] != kKpkUnknown) {
+				continue;
+			}
+			Color side_to_move;
+			Square weak_king;
+			Square strong_king;
+			Square pawn;
+			decode(index, side_to_move, weak_king, strong_king, pawn);
+			int reachable = 0;
+			if (side_to_move == Color::kWhite) {
+				Bitboard moves = KingAttacks(strong_king);
+				while (moves) {
+					Square to = static_cast<Square>(PopLsb(moves));
+					reachable |= results[KpkIndex(Color::kBlack, weak_king, to, pawn)];
+				}
+				Square push = static_cast<Square>(ToIndex(pawn) + kFileCount);
+				if (RankOf(pawn) < kRankCount - 2 && push != strong_king && push != weak_king) {
+					reachable |= results[KpkIndex(Color::kBlack, weak_king, strong_king, push)];
+					Square double_push = static_cast<Square>(ToIndex(push) + kFileCount);
+					if (RankOf(pawn) == 1 && double_push != strong_king &&
+						double_push != weak_king) {
+						reachable |=
+							results[KpkIndex(Color::kBlack, weak_king, strong_king, double_push)];
+					}
+				}
+			} else {
+				Bitboard moves = KingAttacks(weak_king);
+				while (moves) {
+					Square to = static_cast<Square>(PopLsb(moves));
+					reachable |= results[KpkIndex(Color::kWhite, to, strong_king, pawn)];
+				}
+			}
+			std::uint8_t good = side_to_move == Color::kWhite ? kKpkWin : kKpkDraw;
+			std::uint8_t bad = side_to_move == Color::kWhite ? kKpkDraw : kKpkWin;
+			// Settled once one move reaches a good result, or once every move is known bad.
+			if (reachable & good) {
+				results[index] = good;
+				changed = true;
+			} else if (!(reachable & kKpkUnknown)) {
+				results[index] = bad;
+				changed = true;
+			}
+		}
+	}
+
+	kpk_wins_.assign(kKpkSize / 64, 0);
+	for (int index = 0; index < kKpkSize; ++index) {
+		if (results[index] == kKpkWin) {
+			kpk_wins_[index >> 6] |= std::uint64_t{1} << (index & 63);
+		}
+	}
+}
+
+}
+
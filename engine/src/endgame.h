@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "position.h"
+
+namespace flare {
+
+// Scale factors multiply the endgame half of the generic evaluation, out of kScaleNormal.
+constexpr int kScaleNormal = 64;
+// Added to specialized scores for endings that are won with correct technique, so the
+// search prefers them over any unresolved material edge.
+constexpr int kKnownWin = 10000;
+
+// Scores are from the strong side's point of view.
+using EndgameFunction = int (*)(const Position& position, Color strong);
+using ScaleFunction = int (*)(const Position& position, Color strong);
+
+struct EndgameEntry {
+	EndgameFunction evaluate = nullptr;
+	ScaleFunction scale = nullptr;
+	Color strong = Color::kWhite;
+};
+
+// Material key of a signature such as "KBNK": the strong side's pieces from the first king
+// up to the second, then the weak side's.
+std::uint64_t MaterialKey(std::string_view code, Color strong);
+
+// Specialized evaluation and scaling for known endings, indexed by Position::material_key_.
+// The table and the KPK bitbase are built once, on first use.
+class Endgames {
+public:
+	static const Endgames& Instance();
+
+	// Specialized score from the side to move's point of view when the material signature
+	// has one.
+	bool Evaluate(const Position& position, int& score) const;
+	bool HasEvaluation(const Position& position) const;
+	// Scale for the generic evaluation, given the side its endgame half favours.
+	int Scale(const Position& position, Color strong) const;
+	// Whether the side with the pawn wins king and pawn against king with best play.
+	bool ProbeKpk(Color strong, Square strong_king, Square pawn, Square weak_king,
+		Color side_to_move) const;
+
+private:
+	Endgames();
+
+	void Add(std::string_view code, EndgameFunction evaluate, ScaleFunction scale);
+	const EndgameEntry* FindEvaluation(const Position& position) const;
+	const EndgameEntry* Find(const Position& position) const;
+	void GenerateKpk();
+
+	std::unordered_map<std::uint64_t, EndgameEntry> entries_;
+	int max_entry_pieces_ = 0;
+	std::array<EndgameEntry, kColorCount> lone_king_{};
+	std::vector<std::uint64_t> kpk_wins_;
+};
+
+}
+
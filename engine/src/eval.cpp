@@ -1,123 +1,308 @@
 #include "eval.h"
 
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <thread>
+#include <vector>
 
 #include "bitboard.h"
+#include "endgame.h"
+#include "psqt.h"
 
 namespace flare {
 namespace {
 
-constexpr std::array<int, kPieceTypeCount> kPieceValue = {
-	0,    // kNone
-	100,  // kPawn
-	320,  // kKnight
-	330,  // kBishop
-	500,  // kRook
-	900,  // kQueen
-	0,    // kKing
+constexpr Score kBishopPairBonus = MakeScore(30, 45);
+// Per reachable square, relative to a typical count for the piece.
+constexpr std::array<Score, kPieceTypeCount> kMobilityWeight = {
+	0, 0, MakeScore(4, 4), MakeScore(5, 5), MakeScore(2, 4), MakeScore(1, 2), 0,
 };
-constexpr int kBishopPairBonus = 30;
-
-constexpr std::array<int, kFileCount> kCenterFile = {0, 1, 2, 3, 3, 2, 1, 0};
-constexpr std::array<int, kRankCount> kCenterRank = {0, 1, 2, 3, 3, 2, 1, 0};
-constexpr std::array<int, kRankCount> kPawnRank = {0, 4, 8, 12, 16, 20, 24, 0};
-constexpr std::array<int, kRankCount> kRookRank = {0, 1, 2, 2, 3, 4, 6, 0};
-
-consteval int PstValue(PieceType type, int file, int rank) {
-	switch (type) {
-		case PieceType::kPawn:
-			return kPawnRank[rank] + kCenterFile[file];
-		case PieceType::kKnight:
-			return (kCenterFile[file] + kCenterRank[rank]) * 4;
-		case PieceType::kBishop:
-			return (kCenterFile[file] + kCenterRank[rank]) * 3;
-		case PieceType::kRook:
-			return kRookRank[rank] + kCenterFile[file];
-		case PieceType::kQueen:
-			return (kCenterFile[file] + kCenterRank[rank]) * 2;
-		case PieceType::kKing:
-			return -(kCenterFile[file] + kCenterRank[rank]) * 5;
-		case PieceType::kNone:
-			return 0;
-	}
-	return 0;
-}
-
-consteval std::array<int, kSquareCount> MakePst(PieceType type) {
-	std::array<int, kSquareCount> table{};
-	for (int rank = 0; rank < kRankCount; ++rank) {
-		for (int file = 0; file < kFileCount; ++file) {
-			int index = rank * kFileCount + file;
-			table[index] = PstValue(type, file, rank);
+constexpr std::array<int, kPieceTypeCount> kMobilityBase = {0, 0, 4, 6, 7, 13, 0};
+constexpr std::array<int, kPieceTypeCount> kKingAttackWeight = {0, 0, 2, 2, 3, 5, 0};
+constexpr int kKingDangerLimit = 400;
+constexpr std::size_t kBatchBlock = 256;
+constexpr std::size_t kMinBatchPerThread = 4096;
+
+Score EvaluateBishopPair(const Position& position) {
+	Score score = 0;
+	for (int color_index = 0; color_index < kColorCount; ++color_index) {
+		int sign = color_index == ToIndex(Color::kWhite) ? 1 : -1;
+		if (std::popcount(position.piece_bb_[color_index][ToIndex(PieceType::kBishop)]) >= 2) {
+			score += sign * kBishopPairBonus;
 		}
 	}
-	return table;
+	return score;
 }
 
-constexpr auto kPawnPst = MakePst(PieceType::kPawn);
-constexpr auto kKnightPst = MakePst(PieceType::kKnight);
-constexpr auto kBishopPst = MakePst(PieceType::kBishop);
-constexpr auto kRookPst = MakePst(PieceType::kRook);
-constexpr auto kQueenPst = MakePst(PieceType::kQueen);
-constexpr auto kKingPst = MakePst(PieceType::kKing);
+Score EvaluatePawns(const Position& position, PawnEntry& pawns) {
+	int shield = KingShield(position, pawns, Color::kWhite) -
+		KingShield(position, pawns, Color::kBlack);
+	return pawns.score + MakeScore(shield, 0);
+}
+
+Score EvaluateMobility(const Position& position, const AttackInfo& attacks) {
+	Score score = 0;
+	for (int color_index = 0; color_index < kColorCount; ++color_index) {
+		int sign = color_index == ToIndex(Color::kWhite) ? 1 : -1;
+		int them = ToIndex(OppositeColor(static_cast<Color>(color_index)));
+		// Squares not blocked by our own pieces and not covered by enemy pawns.
+		Bitboard area = ~position.occupancy_bb_[color_index] &
+			~attacks.by_type[them][ToIndex(PieceType::kPawn)];
+		for (int type_index = ToIndex(PieceType::kKnight);
+			type_index <= ToIndex(PieceType::kQueen); ++type_index) {
+			Bitboard pieces = position.piece_bb_[color_index][type_index];
+			while (pieces) {
+				int reach = std::popcount(attacks.by_square[PopLsb(pieces)] & area);
+				score += sign * kMobilityWeight[type_index] * (reach - kMobilityBase[type_index]);
+			}
+		}
+	}
+	return score;
+}
 
-const std::array<int, kSquareCount>& PstFor(PieceType type) {
-	switch (type) {
-		case PieceType::kPawn:
-			return kPawnPst;
-		case PieceType::kKnight:
-			return kKnightPst;
-		case PieceType::kBishop:
-			return kBishopPst;
-		case PieceType::kRook:
-			return kRookPst;
-		case PieceType::kQueen:
-			return kQueenPst;
-		case PieceType::kKing:
-			return kKingPst;
-		case PieceType::kNone:
-			return kPawnPst;
+// Counts enemy pieces hitting the squares around each king. A lone attacker is ignored;
+// from two attackers on, the danger grows with the square of the weighted hits.
+Score EvaluateKingSafety(const Position& position, const AttackInfo& attacks) {
+	Score score = 0;
+	for (int color_index = 0; color_index < kColorCount; ++color_index) {
+		Color color = static_cast<Color>(color_index);
+		Square king_square = position.KingSquare(color);
+		if (king_square == Square::kNoSquare) {
+			continue;
+		}
+		int sign = color == Color::kWhite ? 1 : -1;
+		int them = ToIndex(OppositeColor(color));
+		Bitboard zone = attacks.by_square[ToIndex(king_square)] | SquareBit(king_square);
+		int attackers = 0;
+		int units = 0;
+		for (int type_index = ToIndex(PieceType::kKnight);
+			type_index <= ToIndex(PieceType::kQueen); ++type_index) {
+			Bitboard pieces = position.piece_bb_[them][type_index];
+			while (pieces) {
+				Bitboard hits = attacks.by_square[PopLsb(pieces)] & zone;
+				if (hits) {
+					++attackers;
+					units += kKingAttackWeight[type_index] * std::popcount(hits);
+				}
+			}
+		}
+		// Zone squares hit twice that no pawn of ours covers.
+		units += std::popcount(zone & attacks.double_attacked[them] &
+			~attacks.by_type[color_index][ToIndex(PieceType::kPawn)]);
+		if (attackers >= 2) {
+			score -= sign * MakeScore(std::min(units * units / 4, kKingDangerLimit), 0);
+		}
 	}
-	return kPawnPst;
+	return score;
+}
+
+// Blends the two halves by the material phase, clamped so promotions cannot push the
+// midgame weight past its full value. The endgame half is scaled for drawish endings. Both the
+// single-position and the batched evaluations go through here.
+int Taper(Score score, int phase, int scale = kScaleNormal) {
+	phase = std::min(phase, kMaxPhase);
+	int endgame = EndgameValue(score) * scale / kScaleNormal;
+	return (MidgameValue(score) * phase + endgame * (kMaxPhase - phase)) / kMaxPhase;
+}
+
+int EndgameScale(const Position& position, Score score) {
+	Color strong = EndgameValue(score) >= 0 ? Color::kWhite : Color::kBlack;
+	return Endgames::Instance().Scale(position, strong);
+}
+
+int FromSideToMove(const Position& position, int score) {
+	return position.side_to_move_ == Color::kBlack ? -score : score;
+}
+
+// Everything except the material and square accumulators.
+Score EvaluateTerms(const Position& position, PawnEntry& pawns, const AttackInfo& attacks) {
+	return EvaluateBishopPair(position) + EvaluatePawns(position, pawns) +
+		EvaluateMobility(position, attacks) + EvaluateKingSafety(position, attacks);
+}
+
+int EvaluateWith(const Position& position, PawnEntry& pawns, const AttackInfo& attacks) {
+	assert(position.psq_ == ComputePsqScore(position));
+	assert(position.phase_ == ComputePhase(position));
+	Score score = position.psq_ + EvaluateTerms(position, pawns, attacks);
+	return FromSideToMove(position,
+		Taper(score, position.phase_, EndgameScale(position, score)));
 }
 
-Square MirrorSquare(Square square) {
-	int file = FileOf(square);
-	int rank = RankOf(square);
-	return MakeSquare(file, kRankCount - 1 - rank);
+// Gathers each block into packed-score, phase, scale and sign columns, then blends them in
+// a branch-free loop the compiler can vectorize. Specialized endings are patched in after.
+void EvaluateSlice(std::span<const Position> positions, std::span<int> scores,
+	EvalContext& context) {
+	const Endgames& endgames = Endgames::Instance();
+	std::array<Score, kBatchBlock> packed;
+	std::array<int, kBatchBlock> phase;
+	std::array<int, kBatchBlock> scale;
+	std::array<int, kBatchBlock> sign;
+	std::array<std::size_t, kBatchBlock> special;
+	std::array<int, kBatchBlock> special_score;
+	AttackInfo attacks;
+	for (std::size_t base = 0; base < positions.size(); base += kBatchBlock) {
+		std::size_t count = std::min(kBatchBlock, positions.size() - base);
+		std::size_t special_count = 0;
+		for (std::size_t i = 0; i < count; ++i) {
+			const Position& position = positions[base + i];
+			packed[i] = 0;
+			phase[i] = 0;
+			scale[i] = kScaleNormal;
+			sign[i] = position.side_to_move_ == Color::kBlack ? -1 : 1;
+			int score = 0;
+			if (endgames.Evaluate(position, score)) {
+				special[special_count] = i;
+				special_score[special_count++] = score;
+			} else if (context.network) {
+				context.accumulators.Reset();
+				special[special_count] = i;
+				special_score[special_count++] =
+					context.accumulators.Evaluate(position, *context.network);
+			} else {
+				ComputeAttackInfo(position, attacks);
+				packed[i] = position.psq_ +
+					EvaluateTerms(position, context.pawn_table.Probe(position), attacks);
+				phase[i] = position.phase_;
+				scale[i] = EndgameScale(position, packed[i]);
+			}
+		}
+		for (std::size_t i = 0; i < count; ++i) {
+			scores[base + i] = sign[i] * Taper(packed[i], phase[i], scale[i]);
+		}
+		for (std::size_t j = 0; j < special_count; ++j) {
+			scores[base + special[j]] = special_score[j];
+		}
+	}
 }
 
 }
 
 int Evaluate(const Position& position) {
 	int score = 0;
+	if (Endgames::Instance().Evaluate(position, score)) {
+		return score;
+	}
+	PawnEntry pawns;
+	EvaluatePawnStructure(position, pawns);
+	AttackInfo attacks;
+	ComputeAttackInfo(position, attacks);
+	return EvaluateWith(position, pawns, attacks);
+}
+
+EvalStats& EvalStats::operator+=(const EvalStats& other) {
+	lazy += other.lazy;
+	full += other.full;
+	cache_probes += other.cache_probes;
+	cache_hits += other.cache_hits;
+	return *this;
+}
+
+int Evaluate(const Position& position, EvalContext& context) {
+	int score = 0;
+	if (ProbeEvalCache(position, context, score)) {
+		return score;
+	}
+	AttackInfo attacks;
+	if (!context.network) {
+		ComputeAttackInfo(position, attacks);
+	}
+	return Evaluate(position, context, attacks);
+}
+
+int Evaluate(const Position& position, EvalContext& context, const AttackInfo& attacks) {
+	++context.stats.full;
+	int score = 0;
+	if (!Endgames::Instance().Evaluate(position, score)) {
+		score = context.network
+			? context.accumulators.Evaluate(position, *context.network)
+			: EvaluateWith(position, context.pawn_table.Probe(position), attacks);
+	}
+	context.eval_cache.Store(position.hash_, score);
+	return score;
+}
+
+bool ProbeEvalCache(const Position& position, EvalContext& context, int& score) {
+	++context.stats.cache_probes;
+	if (!context.eval_cache.Probe(position.hash_, score)) {
+		return false;
+	}
+	++context.stats.cache_hits;
+	return true;
+}
+
+bool TryLazyEvaluate(const Position& position, EvalContext& context, int alpha, int beta,
+	int& score) {
+	if (context.network) {
+		return false;
+	}
+	int material = FromSideToMove(position, Taper(position.psq_, position.phase_));
+	if (material - kLazyEvalMargin < beta && material + kLazyEvalMargin > alpha) {
+		return false;
+	}
+	// Known endings are lopsided in material but must be played by their own evaluation.
+	if (Endgames::Instance().HasEvaluation(position)) {
+		return false;
+	}
+	++context.stats.lazy;
+	score = material;
+	return true;
+}
+
+void EvaluateBatch(std::span<const Position> positions, std::span<int> scores, int threads,
+	const nnue::Network* network) {
+	assert(scores.size() >= positions.size());
+	std::size_t workers = std::clamp<std::size_t>(positions.size() / kMinBatchPerThread, 1,
+		static_cast<std::size_t>(std::max(1, threads)));
+	if (workers == 1) {
+		EvalContext context;
+		context.network = network;
+		EvaluateSlice(positions, scores, context);
+		return;
+	}
+	std::size_t slice = (positions.size() + workers - 1) / workers;
+	std::vector<std::thread> pool;
+	pool.reserve(workers);
+	for (std::size_t begin = 0; begin < positions.size(); begin += slice) {
+		std::size_t count = std::min(slice, positions.size() - begin);
+		pool.emplace_back([positions, scores, network, begin, count]() {
+			EvalContext context;
+			context.network = network;
+			EvaluateSlice(positions.subspan(begin, count), scores.subspan(begin, count), context);
+		});
+	}
+	for (auto& worker : pool) {
+		worker.join();
+	}
+}
+
+Score ComputePsqScore(const Position& position) {
+	Score score = 0;
 	for (int color_index = 0; color_index < kColorCount; ++color_index) {
 		Color color = static_cast<Color>(color_index);
-		int sign = color == Color::kWhite ? 1 : -1;
-		if (std::popcount(position.piece_bb_[color_index][ToIndex(PieceType::kBishop)]) >= 2) {
-			score += sign * kBishopPairBonus;
-		}
 		for (int type_index = ToIndex(PieceType::kPawn);
 			type_index <= ToIndex(PieceType::kKing); ++type_index) {
-			PieceType type = static_cast<PieceType>(type_index);
+			Piece piece = MakePiece(color, static_cast<PieceType>(type_index));
 			Bitboard pieces = position.piece_bb_[color_index][type_index];
-			const auto& pst = PstFor(type);
 			while (pieces) {
-				int square_index = PopLsb(pieces);
-				Square square = static_cast<Square>(square_index);
-				if (color == Color::kBlack) {
-					square = MirrorSquare(square);
-				}
-				int value = kPieceValue[type_index];
-				score += sign * (value + pst[ToIndex(square)]);
+				score += kPsq[ToIndex(piece)][PopLsb(pieces)];
 			}
 		}
 	}
+	return score;
+}
 
-	if (position.side_to_move_ == Color::kBlack) {
-		score = -score;
+int ComputePhase(const Position& position) {
+	int phase = 0;
+	for (int color_index = 0; color_index < kColorCount; ++color_index) {
+		for (int type_index = ToIndex(PieceType::kKnight);
+			type_index <= ToIndex(PieceType::kQueen); ++type_index) {
+			phase += kPhaseWeight[type_index] *
+				std::popcount(position.piece_bb_[color_index][type_index]);
+		}
 	}
-	return score;
+	return phase;
 }
 
 }
+
@@ -1,10 +1,63 @@
 #pragma once
 
+#include <cstdint>
+#include <span>
+
+#include "attack.h"
+#include "eval_cache.h"
+#include "nnue.h"
+#include "pawns.h"
 #include "position.h"
 
 namespace flare {
 
+// How often each evaluation tier answered.
+struct EvalStats {
+	// Settled by the material and square tier alone.
+	std::uint64_t lazy = 0;
+	std::uint64_t full = 0;
+	std::uint64_t cache_probes = 0;
+	std::uint64_t cache_hits = 0;
+
+	EvalStats& operator+=(const EvalStats& other);
+};
+
+// Per-thread caches used by the evaluation. With a network set, Evaluate uses it and the
+// search keeps the accumulators in step with the moves it makes.
+struct EvalContext {
+	PawnTable pawn_table;
+	EvalCache eval_cache;
+	const nnue::Network* network = nullptr;
+	// Fingerprint of the network the evaluation cache was filled with; zero for classical.
+	std::uint64_t evaluator = 0;
+	nnue::AccumulatorStack accumulators;
+	EvalStats stats;
+};
+
+// Distance outside the window at which the cheap tier is trusted without the positional
+// terms.
+constexpr int kLazyEvalMargin = 400;
+
 int Evaluate(const Position& position);
+// Consults the evaluation cache first and fills it on a miss.
+int Evaluate(const Position& position, EvalContext& context);
+// Reuses attack maps the caller already built for this node. It fills the evaluation
+// cache but does not probe it: callers probe with ProbeEvalCache before any tier.
+int Evaluate(const Position& position, EvalContext& context, const AttackInfo& attacks);
+bool ProbeEvalCache(const Position& position, EvalContext& context, int& score);
+// Cheap tier for bounded callers such as quiescence stand-pat: sets score to the tapered
+// material and square sum and returns true when that is already below alpha or above
+// beta by more than kLazyEvalMargin. Otherwise the caller needs the full evaluation.
+bool TryLazyEvaluate(const Position& position, EvalContext& context, int alpha, int beta,
+	int& score);
+// Scores many positions from each side to move's point of view. The batch is split into
+// contiguous slices across threads, each with its own caches.
+void EvaluateBatch(std::span<const Position> positions, std::span<int> scores,
+	int threads = 1, const nnue::Network* network = nullptr);
+// Full recomputation of the incremental material, square and phase accumulators, used as
+// a debug cross-check.
+Score ComputePsqScore(const Position& position);
+int ComputePhase(const Position& position);
 
 }
 
@@ -0,0 +1,27 @@
+#include "eval_cache.h"
+
+#include <algorithm>
+
+namespace flare {
+
+EvalCache::EvalCache() : entries_(kEntryCount) {}
+
+void EvalCache::Clear() {
+	std::fill(entries_.begin(), entries_.end(), Entry{});
+}
+
+bool EvalCache::Probe(std::uint64_t key, int& score) const {
+	const Entry& entry = entries_[key & (kEntryCount - 1)];
+	if (!entry.valid || entry.key != key) {
+		return false;
+	}
+	score = entry.score;
+	return true;
+}
+
+void EvalCache::Store(std::uint64_t key, int score) {
+	entries_[key & (kEntryCount - 1)] = {key, score, true};
+}
+
+}
+
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace flare {
+
+// Direct-mapped cache of full static evaluations keyed by the position's Zobrist key.
+// Each search thread owns one, so entries need no synchronisation.
+class EvalCache {
+public:
+	EvalCache();
+
+	void Clear();
+	bool Probe(std::uint64_t key, int& score) const;
+	void Store(std::uint64_t key, int score);
+
+private:
+	struct Entry {
+		std::uint64_t key = 0;
+		std::int32_t score = 0;
+		bool valid = false;
+	};
+
+	static constexpr std::size_t kEntryCount = 1 << 16;
+
+	std::vector<Entry> entries_;
+};
+
+}
+
@@ -3,9 +3,12 @@
 #include <string_view>
 #include <thread>
 
+#include "endgame.h"
 #include "uci.h"
 
 int main(int argc, char* argv[]) {
+	// Builds the endgame table and KPK bitbase before the first search needs them.
+	flare::Endgames::Instance();
 	if (argc > 1 && std::string_view(argv[1]) == "bench") {
 		int depth = 5;
 		int threads = 1;
@@ -20,5 +23,26 @@ int main(int argc, char* argv[]) {
 		}
 		return flare::RunBench(depth, threads);
 	}
+	if (argc > 2 && std::string_view(argv[1]) == "evalbatch") {
+		int threads = 1;
+		if (argc > 3) {
+			threads = std::max(1, std::atoi(argv[3]));
+		} else {
+			unsigned int hardware_threads = std::thread::hardware_concurrency();
+			threads = hardware_threads == 0 ? 1 : static_cast<int>(hardware_threads);
+		}
+		return flare::RunEvalBatch(argv[2], threads, argc > 4 ? argv[4] : "");
+	}
+	if (argc > 2 && std::string_view(argv[1]) == "matebatch") {
+		int max_moves = argc > 3 ? std::max(1, std::atoi(argv[3])) : 5;
+		int threads = 1;
+		if (argc > 4) {
+			threads = std::max(1, std::atoi(argv[4]));
+		} else {
+			unsigned int hardware_threads = std::thread::hardware_concurrency();
+			threads = hardware_threads == 0 ? 1 : static_cast<int>(hardware_threads);
+		}
+		return flare::RunMateBatch(argv[2], max_moves, threads);
+	}
 	return flare::RunUciLoop();
 }
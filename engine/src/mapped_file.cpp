@@ -0,0 +1,200 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <utility>
+
+namespace flare {
+namespace {
+
+class FileDescriptor {
+public:
+	explicit FileDescriptor(int fd) : fd_(fd) {}
+	~FileDescriptor() {
+		if (fd_ >= 0) {
+			::close(fd_);
+		}
+	}
+
+	FileDescriptor(const FileDescriptor&) = delete;
+	FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+	int Get() const {
+		return fd_;
+	}
+
+private:
+	int fd_ = -1;
+};
+
+std::string SegmentName(const std::string& name) {
+	return name.front() == '/' ? name : "/" + name;
+}
+
+}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: data_(std::exchange(other.data_, nullptr)),
+	  size_(std::exchange(other.size_, 0)),
+	  writable_(std::exchange(other.writable_, false)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		Close();
+		data_ = std::exchange(other.data_, nullptr);
+		size_ = std::exchange(other.size_, 0);
+		writable_ = std::exchange(other.writable_, false);
+	}
+	return *this;
+}
+
+bool MappedFile::OpenReadOnly(const std::string& path) {
+	Close();
+	FileDescriptor fd(::open(path.c_str(), O_RDONLY));
+	if (fd.Get() < 0) {
+		return false;
+	}
+	struct stat info {};
+	if (::fstat(fd.Get(), &info) != 0 || info.st_size <= 0) {
+		return false;
+	}
+	std::size_t size = static_cast<std::size_t>(info.st_size);
+	void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.Get(), 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	data_ = static_cast<std::byte*>(data);
+	size_ = size;
+	writable_ = false;
+	return true;
+}
+
+bool MappedFile::OpenReadWrite(const std::string& path, std::size_t size, bool& created) {
+	Close();
+	created = false;
+	if (size == 0) {
+		return false;
+	}
+	int raw_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (raw_fd >= 0) {
+		created = true;
+	} else if (errno == EEXIST) {
+		raw_fd = ::open(path.c_str(), O_RDWR);
+	}
+	FileDescriptor fd(raw_fd);
+	if (fd.Get() < 0) {
+		return false;
+	}
+	if (created) {
+		if (::ftruncate(fd.Get(), static_cast<off_t>(size)) != 0) {
+			::unlink(path.c_str());
+			created = false;
+			return false;
+		}
+	} else {
+		struct stat info {};
+		if (::fstat(fd.Get(), &info) != 0 || static_cast<std::size_t>(info.st_size) != size) {
+			return false;
+		}
+	}
+	void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.Get(), 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	data_ = static_cast<std::byte*>(data);
+	size_ = size;
+	writable_ = true;
+	return true;
+}
+
+bool MappedFile::OpenSharedMemory(const std::string& name, std::size_t size, bool& created) {
+	Close();
+	created = false;
+	if (name.empty() || size == 0) {
+		return false;
+	}
+	std::string segment = SegmentName(name);
+	int raw_fd = ::shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (raw_fd >= 0) {
+		created = true;
+	} else if (errno == EEXIST) {
+		raw_fd = ::shm_open(segment.c_str(), O_RDWR, 0600);
+	}
+	FileDescriptor fd(raw_fd);
+	if (fd.Get() < 0) {
+		return false;
+	}
+	if (created) {
+		if (::ftruncate(fd.Get(), static_cast<off_t>(size)) != 0) {
+			::shm_unlink(segment.c_str());
+			return false;
+		}
+	} else {
+		// The creating process may still be sizing the segment.
+		struct stat info {};
+		for (int attempt = 0; attempt < 100; ++attempt) {
+			if (::fstat(fd.Get(), &info) != 0) {
+				return false;
+			}
+			if (info.st_size != 0) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if (static_cast<std::size_t>(info.st_size) != size) {
+			return false;
+		}
+	}
+	void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.Get(), 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	data_ = static_cast<std::byte*>(data);
+	size_ = size;
+	writable_ = true;
+	return true;
+}
+
+bool MappedFile::UnlinkSharedMemory(const std::string& name) {
+	return !name.empty() && ::shm_unlink(SegmentName(name).c_str()) == 0;
+}
+
+void MappedFile::Sync() {
+	if (data_ && writable_) {
+		::msync(data_, size_, MS_SYNC);
+	}
+}
+
+void MappedFile::Close() {
+	if (!data_) {
+		return;
+	}
+	::munmap(data_, size_);
+	data_ = nullptr;
+	size_ = 0;
+	writable_ = false;
+}
+
+bool MappedFile::IsOpen() const {
+	return data_ != nullptr;
+}
+
+std::byte* MappedFile::Data() const {
+	return data_;
+}
+
+std::size_t MappedFile::Size() const {
+	return size_;
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace flare {
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool OpenReadOnly(const std::string& path);
+	// Maps the file writable. A missing file is created with exactly size bytes and created
+	// is set; an existing file of any other size is refused and left untouched.
+	bool OpenReadWrite(const std::string& path, std::size_t size, bool& created);
+	// Maps a named POSIX shared-memory segment; created reports whether this call made it.
+	bool OpenSharedMemory(const std::string& name, std::size_t size, bool& created);
+	// Removes the segment's name; processes that have it mapped keep their mapping.
+	static bool UnlinkSharedMemory(const std::string& name);
+	void Sync();
+	void Close();
+
+	bool IsOpen() const;
+	std::byte* Data() const;
+	std::size_t Size() const;
+
+private:
+	std::byte* data_ = nullptr;
+	std::size_t size_ = 0;
+	bool writable_ = false;
+};
+
+}
+
@@ -0,0 +1,445 @@
+#include "mate_solver.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <utility>
+
+#include "attack.h"
+#include "movegen.h"
+
+namespace flare {
+namespace {
+
+// Proof and disproof numbers saturate here. Paired with a zero it marks a solved node; on its
+// own it only means the numbers grew too large to follow.
+constexpr std::uint64_t kInfinite = (std::uint64_t{1} << 28) - 1;
+constexpr int kNumberBits = 28;
+constexpr std::uint64_t kNumberMask = (std::uint64_t{1} << kNumberBits) - 1;
+
+bool InCheck(const Position& position) {
+	Square king_square = position.KingSquare(position.side_to_move_);
+	return king_square != Square::kNoSquare &&
+		IsSquareAttacked(position, king_square, OppositeColor(position.side_to_move_));
+}
+
+// Makes every move once for its child's key. The attacker's moves are put in order checks,
+// captures, the rest: with equal numbers the proof search takes the first child, and forcing
+// moves are the likeliest mates. With one move left only a check can mate.
+void PrepareMoves(Position& position, std::vector<Move>& moves, std::vector<std::uint64_t>& keys,
+	bool attacker, bool checks_only) {
+	std::array<std::vector<std::pair<Move, std::uint64_t>>, 3> groups;
+	for (Move move : moves) {
+		MoveState state;
+		MakeMove(position, move, state);
+		std::size_t group = 0;
+		if (attacker && !InCheck(position)) {
+			group = CapturedPiece(move) != PieceType::kNone ? 1 : 2;
+		}
+		std::uint64_t key = position.hash_;
+		UndoMove(position, move, state);
+		if (group == 0 || !checks_only) {
+			groups[group].emplace_back(move, key);
+		}
+	}
+	moves.clear();
+	keys.clear();
+	for (const auto& group : groups) {
+		for (const auto& [move, key] : group) {
+			moves.push_back(move);
+			keys.push_back(key);
+		}
+	}
+}
+
+std::uint64_t AddBounded(std::uint64_t left, std::uint64_t right) {
+	return std::min(kInfinite, left + right);
+}
+
+}
+
+// phi and delta are the proof and disproof numbers from the side to move's point of view, so
+// a node's phi is the least delta among its children and its delta the sum of their phis.
+// A solved node also records how many attacking moves its result takes: the mate found is at
+// most that long, or the escape holds for at least that many.
+struct MateSolver::Bounds {
+	std::uint64_t phi = 1;
+	std::uint64_t delta = 1;
+	int remaining = 0;
+};
+
+// The key is stored xor the data so a torn write between threads reads as a miss.
+struct MateSolver::Slot {
+	std::atomic<std::uint64_t> key{0};
+	std::atomic<std::uint64_t> data{0};
+};
+
+struct MateSolver::Worker {
+	Position position;
+	std::uint64_t nodes = 0;
+	std::uint64_t node_limit = 0;
+	// The caller's flag, only read: running out of nodes or time ends the solve, not the
+	// caller's search.
+	const std::atomic<bool>* stop = nullptr;
+	// Raised once any thread has run out of its nodes or the deadline has passed.
+	std::atomic<bool>* exhausted = nullptr;
+	// Raised once any thread has settled the current mate length.
+	std::atomic<bool>* done = nullptr;
+	TimeManager* time = nullptr;
+};
+
+MateSolver::MateSolver(std::size_t megabytes) {
+	Resize(megabytes);
+}
+
+MateSolver::~MateSolver() = default;
+
+void MateSolver::Resize(std::size_t megabytes) {
+	std::size_t count = std::max<std::size_t>(1, megabytes) * 1024 * 1024 / sizeof(Slot);
+	slot_count_ = std::bit_floor(std::max<std::size_t>(1, count));
+	slots_ = std::make_unique<Slot[]>(slot_count_);
+}
+
+void MateSolver::Clear() {
+	for (std::size_t index = 0; index < slot_count_; ++index) {
+		slots_[index].key.store(0, std::memory_order_relaxed);
+		slots_[index].data.store(0, std::memory_order_relaxed);
+	}
+}
+
+bool MateSolver::Probe(std::uint64_t key, int remaining, bool attacker, Bounds& bounds) const {
+	const Slot& slot = slots_[key & (slot_count_ - 1)];
+	std::uint64_t data = slot.data.load(std::memory_order_relaxed);
+	if ((slot.key.load(std::memory_order_relaxed) ^ data) != key || data == 0) {
+		return false;
+	}
+	Bounds stored{data & kNumberMask, (data >> kNumberBits) & kNumberMask,
+		static_cast<int>(data >> (2 * kNumberBits))};
+	if (stored.remaining == remaining) {
+		bounds = stored;
+		return true;
+	}
+	// More moves never hurt the attacker: a mate holds with more moves left and an escape
+	// holds with fewer.
+	bool mates = attacker ? stored.phi == 0 : stored.delta == 0;
+	bool escapes = attacker ? stored.delta == 0 : stored.phi == 0;
+	if ((mates && stored.remaining <= remaining) || (escapes && stored.remaining >= remaining)) {
+		bounds = stored;
+		return true;
+	}
+	return false;
+}
+
+void MateSolver::Store(std::uint64_t key, const Bounds& bounds) {
+	Slot& slot = slots_[key & (slot_count_ - 1)];
+	std::uint64_t data = bounds.phi | (bounds.delta << kNumberBits) |
+		(static_cast<std::uint64_t>(bounds.remaining) << (2 * kNumberBits));
+	slot.key.store(key ^ data, std::memory_order_relaxed);
+	slot.data.store(data, std::memory_order_relaxed);
+}
+
+bool MateSolver::ShouldStop(Worker& worker) const {
+	if (worker.stop->load(std::memory_order_relaxed) ||
+		worker.exhausted->load(std::memory_order_relaxed) ||
+		worker.done->load(std::memory_order_relaxed)) {
+		return true;
+	}
+	if (worker.node_limit != 0 && worker.nodes >= worker.node_limit) {
+		worker.exhausted->store(true, std::memory_order_relaxed);
+		return true;
+	}
+	if (!worker.time || (worker.nodes & 1023) != 0) {
+		return false;
+	}
+	worker.time->Poll();
+	if (std::chrono::steady_clock::now() < worker.time->Deadline()) {
+		return false;
+	}
+	worker.exhausted->store(true, std::memory_order_relaxed);
+	return true;
+}
+
+// Expands the node at worker.position until its numbers reach a threshold, keeping the most
+// promising child's thresholds just past those of its best sibling. Only a restricted root
+// passes its moves, and its result is not stored.
+MateSolver::Bounds MateSolver::Expand(Worker& worker, std::uint64_t threshold_phi,
+	std::uint64_t threshold_delta, int remaining, bool attacker,
+	const std::vector<Move>* root_moves) {
+	Position& position = worker.position;
+	std::uint64_t key = position.hash_;
+	++worker.nodes;
+	std::vector<Move> moves;
+	if (root_moves) {
+		moves = *root_moves;
+	} else {
+		GenerateLegalMoves(position, moves);
+	}
+	Bounds bounds;
+	bounds.remaining = remaining;
+	if (moves.empty()) {
+		// Mated defenders lose at once; stalemate is an escape.
+		bool mated = !attacker && InCheck(position);
+		bounds.phi = mated || attacker ? kInfinite : 0;
+		bounds.delta = mated || attacker ? 0 : kInfinite;
+		bounds.remaining = mated ? 0 : remaining;
+		Store(key, bounds);
+		return bounds;
+	}
+	if (!attacker && remaining == 0) {
+		bounds.phi = 0;
+		bounds.delta = kInfinite;
+		Store(key, bounds);
+		return bounds;
+	}
+
+	std::vector<std::uint64_t> keys;
+	PrepareMoves(position, moves, keys, attacker, attacker && remaining == 1);
+	int child_remaining = attacker ? remaining - 1 : remaining;
+	std::vector<Bounds> children(moves.size());
+	for (std::size_t index = 0; index < moves.size(); ++index) {
+		if (!Probe(keys[index], child_remaining, !attacker, children[index])) {
+			MoveState state;
+			MakeMove(position, moves[index], state);
+			children[index] = Estimate(child_remaining, !attacker, position);
+			UndoMove(position, moves[index], state);
+		}
+	}
+	int fastest_win = std::numeric_limits<int>::max();
+	int slowest_loss = 0;
+	while (true) {
+		bounds.phi = kInfinite;
+		bounds.delta = 0;
+		std::size_t best = 0;
+		std::uint64_t second_delta = kInfinite;
+		fastest_win = std::numeric_limits<int>::max();
+		slowest_loss = 0;
+		for (std::size_t index = 0; index < moves.size(); ++index) {
+			// Helpers may have moved a child on; a miss keeps what this thread last saw.
+			Probe(keys[index], child_remaining, !attacker, children[index]);
+			const Bounds& child = children[index];
+			if (child.delta < bounds.phi) {
+				second_delta = bounds.phi;
+				bounds.phi = child.delta;
+				best = index;
+			} else if (child.delta < second_delta) {
+				second_delta = child.delta;
+			}
+			bounds.delta = AddBounded(bounds.delta, child.phi);
+			if (child.delta == 0) {
+				fastest_win = std::min(fastest_win, child.remaining);
+			}
+			slowest_loss = std::max(slowest_loss, child.remaining);
+		}
+		if (bounds.phi >= threshold_phi || bounds.delta >= threshold_delta ||
+			ShouldStop(worker)) {
+			break;
+		}
+		std::uint64_t child_threshold_phi = threshold_delta >= kInfinite ? kInfinite
+			: std::min(kInfinite, threshold_delta - bounds.delta + children[best].phi);
+		std::uint64_t child_threshold_delta =
+			std::min(threshold_phi, second_delta >= kInfinite ? kInfinite : second_delta + 1);
+		MoveState state;
+		MakeMove(position, moves[best], state);
+		children[best] = Expand(worker, child_threshold_phi, child_threshold_delta,
+			child_remaining, !attacker, nullptr);
+		UndoMove(position, moves[best], state);
+	}
+	// Keep the mate length as tight as the proof: one move more than the quickest mating
+	// child, or the slowest defence when every reply loses.
+	if (attacker && bounds.phi == 0) {
+		bounds.remaining = fastest_win + 1;
+	} else if (!attacker && bounds.delta == 0) {
+		bounds.remaining = slowest_loss;
+	}
+	if (!root_moves) {
+		Store(key, bounds);
+	}
+	return bounds;
+}
+
+// Numbers for a node not searched yet. Fewer replies make a side's position easier to refute,
+// and a node without replies is settled on the spot.
+MateSolver::Bounds MateSolver::Estimate(int remaining, bool attacker, Position& position) {
+	std::vector<Move> replies;
+	GenerateLegalMoves(position, replies);
+	auto count = static_cast<std::uint64_t>(replies.size());
+	Bounds bounds{1, std::max<std::uint64_t>(1, count), remaining};
+	if (replies.empty()) {
+		bool mated = !attacker && InCheck(position);
+		bounds = mated || attacker ? Bounds{kInfinite, 0, mated ? 0 : remaining}
+			: Bounds{0, kInfinite, remaining};
+	} else if (!attacker && remaining == 0) {
+		bounds = Bounds{0, kInfinite, remaining};
+	}
+	return bounds;
+}
+
+// Settles the node at worker.position from the table, or by solving it outright. The result
+// is unsolved only when the search was stopped.
+MateSolver::Bounds MateSolver::Resolve(Worker& worker, int remaining, bool attacker) {
+	Bounds bounds;
+	if (Probe(worker.position.hash_, remaining, attacker, bounds) &&
+		(bounds.phi == 0 || bounds.delta == 0)) {
+		return bounds;
+	}
+	return Expand(worker, kInfinite, kInfinite, remaining, attacker, nullptr);
+}
+
+// Follows a proven mate in at most `moves` from worker.position: the attacker takes the
+// quickest proven mate and the defender the reply whose mate takes longest.
+std::vector<Move> MateSolver::ExtractPv(Worker& worker, const std::vector<Move>& root_moves,
+	int moves) {
+	Position& position = worker.position;
+	std::vector<Move> pv;
+	std::vector<MoveState> states;
+	std::vector<std::uint64_t> keys;
+	int remaining = moves;
+	bool attacker = true;
+	while (!worker.stop->load(std::memory_order_relaxed)) {
+		std::vector<Move> candidates;
+		if (pv.empty()) {
+			candidates = root_moves;
+		} else {
+			GenerateLegalMoves(position, candidates);
+		}
+		if (candidates.empty()) {
+			break;
+		}
+		int child_remaining = attacker ? remaining - 1 : remaining;
+		PrepareMoves(position, candidates, keys, attacker, attacker && remaining == 1);
+		// The table usually holds the proof; children it lost are solved again, and for the
+		// attacker only until one mates.
+		Move chosen = kNoMove;
+		int chosen_remaining = 0;
+		for (bool table_only : {true, false}) {
+			for (std::size_t index = 0; index < candidates.size(); ++index) {
+				Bounds child;
+				bool solved = Probe(keys[index], child_remaining, !attacker, child) &&
+					(child.phi == 0 || child.delta == 0);
+				if (!solved && !table_only) {
+					MoveState state;
+					MakeMove(position, candidates[index], state);
+					child = Resolve(worker, child_remaining, !attacker);
+					UndoMove(position, candidates[index], state);
+				} else if (!solved || !table_only) {
+					continue;
+				}
+				if (attacker && child.delta == 0 &&
+					(chosen == kNoMove || child.remaining < chosen_remaining)) {
+					chosen = candidates[index];
+					chosen_remaining = child.remaining;
+				} else if (!attacker && child.phi == 0 &&
+					(chosen == kNoMove || child.remaining > chosen_remaining)) {
+					chosen = candidates[index];
+					chosen_remaining = child.remaining;
+				}
+				if (attacker && !table_only && chosen != kNoMove) {
+					break;
+				}
+			}
+			if (attacker && chosen != kNoMove) {
+				break;
+			}
+		}
+		if (chosen == kNoMove) {
+			break;
+		}
+		states.emplace_back();
+		MakeMove(position, chosen, states.back());
+		pv.push_back(chosen);
+		remaining = chosen_remaining;
+		attacker = !attacker;
+	}
+	for (std::size_t index = pv.size(); index-- > 0;) {
+		UndoMove(position, pv[index], states[index]);
+	}
+	return pv;
+}
+
+MateSolution MateSolver::Solve(const Position& position, int max_moves,
+	const MateSolverLimits& limits) {
+	MateSolution solution;
+	std::atomic<bool> local_stop{false};
+	std::atomic<bool> exhausted{false};
+	std::atomic<bool> done{false};
+	const std::atomic<bool>* stop = limits.stop ? limits.stop : &local_stop;
+	int threads = std::max(1, limits.threads);
+	int moves = std::min(max_moves, kMaxMoves);
+
+	Position root = position;
+	std::vector<Move> root_moves;
+	GenerateLegalMoves(root, root_moves);
+	bool restricted = !limits.root_moves.empty() && limits.root_moves.size() < root_moves.size();
+	if (restricted) {
+		root_moves = limits.root_moves;
+	}
+	std::vector<std::uint64_t> keys;
+	PrepareMoves(root, root_moves, keys, true, moves == 1);
+	if (moves < 1 || root_moves.empty()) {
+		return solution;
+	}
+	std::vector<Worker> workers(static_cast<std::size_t>(threads));
+	for (Worker& worker : workers) {
+		worker.position = root;
+		worker.stop = stop;
+		worker.exhausted = &exhausted;
+		worker.done = &done;
+		worker.time = limits.time;
+		if (limits.nodes > 0) {
+			worker.node_limit = std::max<std::uint64_t>(1, limits.nodes / workers.size());
+		}
+	}
+
+	std::atomic<std::size_t> next_root{0};
+	std::vector<std::thread> helpers;
+	for (std::size_t index = 1; index < workers.size(); ++index) {
+		helpers.emplace_back([this, &worker = workers[index], &root_moves, &next_root, &done,
+			moves]() {
+			while (!ShouldStop(worker)) {
+				std::size_t root_index = next_root.fetch_add(1, std::memory_order_relaxed);
+				if (root_index >= root_moves.size()) {
+					break;
+				}
+				MoveState state;
+				MakeMove(worker.position, root_moves[root_index], state);
+				Bounds child = Resolve(worker, moves - 1, false);
+				UndoMove(worker.position, root_moves[root_index], state);
+				if (child.delta == 0) {
+					done.store(true, std::memory_order_relaxed);
+				}
+			}
+		});
+	}
+	Bounds bounds = Expand(workers.front(), kInfinite, kInfinite, moves, true,
+		restricted ? &root_moves : nullptr);
+	if (bounds.phi == 0) {
+		done.store(true, std::memory_order_relaxed);
+	}
+	for (std::thread& helper : helpers) {
+		helper.join();
+	}
+	bool cut_short =
+		stop->load(std::memory_order_relaxed) || exhausted.load(std::memory_order_relaxed);
+	if (!cut_short && !done.load(std::memory_order_relaxed)) {
+		solution.disproved = bounds.delta == 0;
+		solution.saturated = !solution.disproved;
+	}
+	if (done.load(std::memory_order_relaxed) && !cut_short) {
+		// Every step of the line is proven, so it is walked without the node limit.
+		done.store(false, std::memory_order_relaxed);
+		workers.front().node_limit = 0;
+		solution.pv = ExtractPv(workers.front(), root_moves, moves);
+		solution.found = solution.pv.size() % 2 == 1;
+		solution.moves = static_cast<int>(solution.pv.size() + 1) / 2;
+	}
+	for (const Worker& worker : workers) {
+		solution.nodes += worker.nodes;
+	}
+	return solution;
+}
+
+}
+
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "move.h"
+#include "position.h"
+#include "time_manager.h"
+
+namespace flare {
+
+struct MateSolverLimits {
+	int threads = 1;
+	// Node budget split evenly between threads; zero for none.
+	std::uint64_t nodes = 0;
+	// Only read; the node budget and the deadline end the solve without raising it.
+	const std::atomic<bool>* stop = nullptr;
+	// Polled for its hard deadline when set.
+	TimeManager* time = nullptr;
+	// Restricts the first move to these when not empty. A root cut down this way is not the
+	// position its key stands for, so its own result is kept out of the table.
+	std::vector<Move> root_moves;
+};
+
+struct MateSolution {
+	bool found = false;
+	// Shown that there is no mate within the limit. Neither this nor found is set when the
+	// limits stopped the search or its numbers saturated first; the answer is then unknown.
+	bool disproved = false;
+	// The proof or disproof numbers reached their ceiling before the root was settled.
+	bool saturated = false;
+	// Length of the mate found against the longest defence, in the attacker's moves. The
+	// search proves a mate within the limit, which is not always the shortest one.
+	int moves = 0;
+	// Attacking line with the longest defence at every reply.
+	std::vector<Move> pv;
+	std::uint64_t nodes = 0;
+};
+
+// Depth-first proof-number search for forced mates. Nodes are keyed by position and the
+// attacking moves left, so the tree is acyclic and a proof of a mate in N is exact. Results
+// live in a fixed-size table of lockless slots that all solver threads share: the first
+// thread runs the proof search from the root while helpers take root moves one at a time and
+// solve them outright, leaving their results in the table.
+class MateSolver {
+public:
+	static constexpr int kMaxMoves = 100;
+
+	explicit MateSolver(std::size_t megabytes = 16);
+	~MateSolver();
+
+	MateSolver(const MateSolver&) = delete;
+	MateSolver& operator=(const MateSolver&) = delete;
+
+	void Resize(std::size_t megabytes);
+	void Clear();
+
+	// Looks for a mate in at most max_moves moves for the side to move. Not found if there is
+	// none or the limits cut the search short.
+	MateSolution Solve(const Position& position, int max_moves, const MateSolverLimits& limits);
+
+private:
+	struct Slot;
+	struct Bounds;
+	struct Worker;
+
+	bool Probe(std::uint64_t key, int remaining, bool attacker, Bounds& bounds) const;
+	void Store(std::uint64_t key, const Bounds& bounds);
+	bool ShouldStop(Worker& worker) const;
+	Bounds Expand(Worker& worker, std::uint64_t threshold_phi, std::uint64_t threshold_delta,
+		int remaining, bool attacker, const std::vector<Move>* root_moves);
+	static Bounds Estimate(int remaining, bool attacker, Position& position);
+	Bounds Resolve(Worker& worker, int remaining, bool attacker);
+	std::vector<Move> ExtractPv(Worker& worker, const std::vector<Move>& root_moves, int moves);
+
+	std::unique_ptr<Slot[]> slots_;
+	std::size_t slot_count_ = 0;
+};
+
+}
+
@@ -1,6 +1,8 @@
 #include "movegen.h"
 
+#include <algorithm>
 #include <array>
+#include <cstdlib>
 
 #include "attack.h"
 #include "bitboard.h"
@@ -83,14 +85,15 @@ void GeneratePawnMoves(Position& position, std::vector<Move>& moves, Color color
 	}
 }
 
-void GenerateKnightMoves(Position& position, std::vector<Move>& moves, Color color) {
+void GenerateKnightMoves(Position& position, std::vector<Move>& moves, Color color,
+	const AttackInfo& info) {
 	int color_index = ToIndex(color);
 	Bitboard knights = position.piece_bb_[color_index][ToIndex(PieceType::kKnight)];
 	Bitboard own_occ = position.occupancy_bb_[color_index];
 	while (knights) {
 		int from_index = PopLsb(knights);
 		Square from = static_cast<Square>(from_index);
-		Bitboard attacks = KnightAttacks(from) & ~own_occ;
+		Bitboard attacks = info.by_square[from_index] & ~own_occ;
 		while (attacks) {
 			int to_index = PopLsb(attacks);
 			Square to = static_cast<Square>(to_index);
@@ -106,22 +109,14 @@ void GenerateKnightMoves(Position& position, std::vector<Move>& moves, Color col
 }
 
 void GenerateSlidingMoves(Position& position, std::vector<Move>& moves, Color color,
-	PieceType piece_type) {
+	PieceType piece_type, const AttackInfo& info) {
 	int color_index = ToIndex(color);
 	Bitboard own_occ = position.occupancy_bb_[color_index];
 	Bitboard pieces = position.piece_bb_[color_index][ToIndex(piece_type)];
 	while (pieces) {
 		int from_index = PopLsb(pieces);
 		Square from = static_cast<Square>(from_index);
-		Bitboard attacks = 0;
-		if (piece_type == PieceType::kBishop) {
-			attacks = BishopAttacks(from, position.all_occupancy_bb_);
-		} else if (piece_type == PieceType::kRook) {
-			attacks = RookAttacks(from, position.all_occupancy_bb_);
-		} else if (piece_type == PieceType::kQueen) {
-			attacks = QueenAttacks(from, position.all_occupancy_bb_);
-		}
-		attacks &= ~own_occ;
+		Bitboard attacks = info.by_square[from_index] & ~own_occ;
 		while (attacks) {
 			int to_index = PopLsb(attacks);
 			Square to = static_cast<Square>(to_index);
@@ -135,7 +130,8 @@ void GenerateSlidingMoves(Position& position, std::vector<Move>& moves, Color co
 	}
 }
 
-void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color) {
+void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color,
+	const AttackInfo& info) {
 	int color_index = ToIndex(color);
 	Bitboard own_occ = position.occupancy_bb_[color_index];
 	Square king_square = position.KingSquare(color);
@@ -143,7 +139,10 @@ void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color
 		return;
 	}
 
-	Bitboard attacks = KingAttacks(king_square) & ~own_occ;
+	Color enemy = OppositeColor(color);
+	Bitboard enemy_attacks = info.attacked[ToIndex(enemy)];
+	Bitboard attacks = info.by_square[ToIndex(king_square)] & ~own_occ &
+		~info.king_danger[color_index];
 	while (attacks) {
 		int to_index = PopLsb(attacks);
 		Square to = static_cast<Square>(to_index);
@@ -156,9 +155,7 @@ void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color
 			MoveFlag::kNone);
 	}
 
-	Color enemy = OppositeColor(color);
-	bool in_check = IsSquareAttacked(position, king_square, enemy);
-	if (in_check) {
+	if (HasBit(enemy_attacks, king_square)) {
 		return;
 	}
 
@@ -167,8 +164,8 @@ void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color
 			if (position.board_[ToIndex(Square::kF1)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kG1)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kH1)] == Piece::kWhiteRook &&
-				!IsSquareAttacked(position, Square::kF1, enemy) &&
-				!IsSquareAttacked(position, Square::kG1, enemy)) {
+				!HasBit(enemy_attacks, Square::kF1) &&
+				!HasBit(enemy_attacks, Square::kG1)) {
 				AddMove(moves, Square::kE1, Square::kG1, PieceType::kKing, PieceType::kNone,
 					PieceType::kNone, MoveFlag::kCastle);
 			}
@@ -178,8 +175,8 @@ void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color
 				position.board_[ToIndex(Square::kC1)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kB1)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kA1)] == Piece::kWhiteRook &&
-				!IsSquareAttacked(position, Square::kD1, enemy) &&
-				!IsSquareAttacked(position, Square::kC1, enemy)) {
+				!HasBit(enemy_attacks, Square::kD1) &&
+				!HasBit(enemy_attacks, Square::kC1)) {
 				AddMove(moves, Square::kE1, Square::kC1, PieceType::kKing, PieceType::kNone,
 					PieceType::kNone, MoveFlag::kCastle);
 			}
@@ -189,8 +186,8 @@ void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color
 			if (position.board_[ToIndex(Square::kF8)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kG8)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kH8)] == Piece::kBlackRook &&
-				!IsSquareAttacked(position, Square::kF8, enemy) &&
-				!IsSquareAttacked(position, Square::kG8, enemy)) {
+				!HasBit(enemy_attacks, Square::kF8) &&
+				!HasBit(enemy_attacks, Square::kG8)) {
 				AddMove(moves, Square::kE8, Square::kG8, PieceType::kKing, PieceType::kNone,
 					PieceType::kNone, MoveFlag::kCastle);
 			}
@@ -200,8 +197,8 @@ void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color
 				position.board_[ToIndex(Square::kC8)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kB8)] == Piece::kNone &&
 				position.board_[ToIndex(Square::kA8)] == Piece::kBlackRook &&
-				!IsSquareAttacked(position, Square::kD8, enemy) &&
-				!IsSquareAttacked(position, Square::kC8, enemy)) {
+				!HasBit(enemy_attacks, Square::kD8) &&
+				!HasBit(enemy_attacks, Square::kC8)) {
 				AddMove(moves, Square::kE8, Square::kC8, PieceType::kKing, PieceType::kNone,
 					PieceType::kNone, MoveFlag::kCastle);
 			}
@@ -209,15 +206,17 @@ void GenerateKingMoves(Position& position, std::vector<Move>& moves, Color color
 	}
 }
 
-void GeneratePseudoLegalMoves(Position& position, std::vector<Move>& moves) {
+// King steps and castling come out already legal; the rest are pseudo-legal.
+void GeneratePseudoLegalMoves(Position& position, std::vector<Move>& moves,
+	const AttackInfo& info) {
 	moves.clear();
 	Color color = position.side_to_move_;
 	GeneratePawnMoves(position, moves, color);
-	GenerateKnightMoves(position, moves, color);
-	GenerateSlidingMoves(position, moves, color, PieceType::kBishop);
-	GenerateSlidingMoves(position, moves, color, PieceType::kRook);
-	GenerateSlidingMoves(position, moves, color, PieceType::kQueen);
-	GenerateKingMoves(position, moves, color);
+	GenerateKnightMoves(position, moves, color, info);
+	GenerateSlidingMoves(position, moves, color, PieceType::kBishop, info);
+	GenerateSlidingMoves(position, moves, color, PieceType::kRook, info);
+	GenerateSlidingMoves(position, moves, color, PieceType::kQueen, info);
+	GenerateKingMoves(position, moves, color, info);
 }
 
 void UpdateCastlingRights(Position& position, Square from, Square to, Piece moved_piece,
@@ -255,6 +254,94 @@ void UpdateCastlingRights(Position& position, Square from, Square to, Piece move
 	}
 }
 
+bool ParseSquare(std::string_view text, Square& square) {
+	if (text[0] < 'a' || text[0] > 'h' || text[1] < '1' || text[1] > '8') {
+		return false;
+	}
+	square = MakeSquare(text[0] - 'a', text[1] - '1');
+	return true;
+}
+
+PieceType ParsePromotion(char promotion) {
+	switch (promotion) {
+		case 'n':
+			return PieceType::kKnight;
+		case 'b':
+			return PieceType::kBishop;
+		case 'r':
+			return PieceType::kRook;
+		case 'q':
+			return PieceType::kQueen;
+		default:
+			return PieceType::kNone;
+	}
+}
+
+// Same conditions as GenerateKingMoves: the right is held, the squares between king and rook
+// are empty and the king neither starts on, passes nor lands on an attacked square.
+bool IsCastlePseudoLegal(const Position& position, Color us, Square from, Square to) {
+	int rank = us == Color::kWhite ? 0 : 7;
+	if (from != MakeSquare(4, rank) || RankOf(to) != rank ||
+		(FileOf(to) != 6 && FileOf(to) != 2)) {
+		return false;
+	}
+	bool king_side = FileOf(to) == 6;
+	std::uint8_t right = us == Color::kWhite
+		? (king_side ? kWhiteKingSideCastle : kWhiteQueenSideCastle)
+		: (king_side ? kBlackKingSideCastle : kBlackQueenSideCastle);
+	int rook_file = king_side ? 7 : 0;
+	if (!(position.castling_rights_ & right) ||
+		position.board_[ToIndex(MakeSquare(rook_file, rank))] != MakePiece(us, PieceType::kRook)) {
+		return false;
+	}
+	for (int file = std::min(4, rook_file) + 1; file < std::max(4, rook_file); ++file) {
+		if (position.board_[ToIndex(MakeSquare(file, rank))] != Piece::kNone) {
+			return false;
+		}
+	}
+	Color them = OppositeColor(us);
+	Square passed = MakeSquare(king_side ? 5 : 3, rank);
+	return !IsSquareAttacked(position, from, them) &&
+		!IsSquareAttacked(position, passed, them) && !IsSquareAttacked(position, to, them);
+}
+
+bool IsPawnPseudoLegal(const Position& position, Color us, Move move) {
+	Square from = FromSquare(move);
+	Square to = ToSquare(move);
+	MoveFlag flag = MoveFlagOf(move);
+	int forward = us == Color::kWhite ? 1 : -1;
+	int last_rank = us == Color::kWhite ? 7 : 0;
+	PieceType promotion = PromotionPiece(move);
+	if ((RankOf(to) == last_rank) != (flag == MoveFlag::kPromotion)) {
+		return false;
+	}
+	if (flag == MoveFlag::kPromotion ? promotion == PieceType::kNone ||
+			promotion == PieceType::kPawn || promotion == PieceType::kKing
+		: promotion != PieceType::kNone) {
+		return false;
+	}
+	bool to_empty = position.board_[ToIndex(to)] == Piece::kNone;
+	if (flag == MoveFlag::kEnPassant) {
+		Square captured = MakeSquare(FileOf(to), RankOf(to) - forward);
+		return to == position.en_passant_square_ && HasBit(PawnAttacks(us, from), to) &&
+			CapturedPiece(move) == PieceType::kPawn && to_empty &&
+			position.board_[ToIndex(captured)] == MakePiece(OppositeColor(us), PieceType::kPawn);
+	}
+	if (FileOf(from) != FileOf(to)) {
+		return HasBit(PawnAttacks(us, from), to) && !to_empty;
+	}
+	if (!to_empty) {
+		return false;
+	}
+	if (flag == MoveFlag::kDoublePush) {
+		int start_rank = us == Color::kWhite ? 1 : 6;
+		Square passed = MakeSquare(FileOf(from), RankOf(from) + forward);
+		return RankOf(from) == start_rank && RankOf(to) == RankOf(from) + 2 * forward &&
+			position.board_[ToIndex(passed)] == Piece::kNone;
+	}
+	return RankOf(to) == RankOf(from) + forward;
+}
+
 }
 
 bool MakeMove(Position& position, Move move, MoveState& state) {
@@ -272,6 +359,7 @@ bool MakeMove(Position& position, Move move, MoveState& state) {
 	state.halfmove_clock_ = position.halfmove_clock_;
 	state.fullmove_number_ = position.fullmove_number_;
 	state.side_to_move_ = position.side_to_move_;
+	position.history_.push_back(position.hash_);
 
 	position.en_passant_square_ = Square::kNoSquare;
 
@@ -345,6 +433,7 @@ void UndoMove(Position& position, Move move, const MoveState& state) {
 	position.en_passant_square_ = state.en_passant_square_;
 	position.halfmove_clock_ = state.halfmove_clock_;
 	position.fullmove_number_ = state.fullmove_number_;
+	position.history_.pop_back();
 
 	Square from = FromSquare(move);
 	Square to = ToSquare(move);
@@ -381,16 +470,36 @@ void UndoMove(Position& position, Move move, const MoveState& state) {
 }
 
 void GenerateLegalMoves(Position& position, std::vector<Move>& moves) {
+	AttackInfo info;
+	ComputeAttackInfo(position, info);
+	GenerateLegalMoves(position, moves, info);
+}
+
+void GenerateLegalMoves(Position& position, std::vector<Move>& moves, const AttackInfo& info) {
 	std::vector<Move> pseudo_moves;
-	GeneratePseudoLegalMoves(position, pseudo_moves);
+	GeneratePseudoLegalMoves(position, pseudo_moves, info);
 
 	moves.clear();
 	Color us = position.side_to_move_;
 	Color them = OppositeColor(us);
+	Square own_king = position.KingSquare(us);
+	if (own_king == Square::kNoSquare) {
+		return;
+	}
+	bool in_check = HasBit(info.attacked[ToIndex(them)], own_king);
+	// Only the first piece on each line from the king can be pinned.
+	Bitboard pin_candidates =
+		QueenAttacks(own_king, position.all_occupancy_bb_) & position.occupancy_bb_[ToIndex(us)];
 	for (Move move : pseudo_moves) {
 		if (CapturedPiece(move) == PieceType::kKing) {
 			continue;
 		}
+		if (MovedPiece(move) == PieceType::kKing ||
+			(!in_check && MoveFlagOf(move) != MoveFlag::kEnPassant &&
+				!HasBit(pin_candidates, FromSquare(move)))) {
+			moves.push_back(move);
+			continue;
+		}
 		MoveState state;
 		MakeMove(position, move, state);
 		Square king_square = position.KingSquare(us);
@@ -402,4 +511,102 @@ void GenerateLegalMoves(Position& position, std::vector<Move>& moves) {
 	}
 }
 
+bool IsPseudoLegal(const Position& position, Move move) {
+	Square from = FromSquare(move);
+	Square to = ToSquare(move);
+	Color us = position.side_to_move_;
+	Piece moved = position.board_[ToIndex(from)];
+	if (move == kNoMove || moved == Piece::kNone || ColorFromPiece(moved) != us ||
+		PieceTypeFromPiece(moved) != MovedPiece(move)) {
+		return false;
+	}
+	Piece target = position.board_[ToIndex(to)];
+	if (MoveFlagOf(move) != MoveFlag::kEnPassant &&
+		(target == Piece::kNone ? CapturedPiece(move) != PieceType::kNone
+			: ColorFromPiece(target) == us || PieceTypeFromPiece(target) != CapturedPiece(move))) {
+		return false;
+	}
+	MoveFlag flag = MoveFlagOf(move);
+	if (MovedPiece(move) == PieceType::kPawn) {
+		return IsPawnPseudoLegal(position, us, move);
+	}
+	if (PromotionPiece(move) != PieceType::kNone) {
+		return false;
+	}
+	if (flag == MoveFlag::kCastle) {
+		return MovedPiece(move) == PieceType::kKing && target == Piece::kNone &&
+			IsCastlePseudoLegal(position, us, from, to);
+	}
+	if (flag != MoveFlag::kNone) {
+		return false;
+	}
+	Bitboard occupancy = position.all_occupancy_bb_;
+	switch (MovedPiece(move)) {
+		case PieceType::kKnight:
+			return HasBit(KnightAttacks(from), to);
+		case PieceType::kBishop:
+			return HasBit(BishopAttacks(from, occupancy), to);
+		case PieceType::kRook:
+			return HasBit(RookAttacks(from, occupancy), to);
+		case PieceType::kQueen:
+			return HasBit(QueenAttacks(from, occupancy), to);
+		case PieceType::kKing:
+			return HasBit(KingAttacks(from), to);
+		default:
+			return false;
+	}
+}
+
+bool IsLegal(Position& position, Move move) {
+	if (!IsPseudoLegal(position, move) || CapturedPiece(move) == PieceType::kKing) {
+		return false;
+	}
+	Color us = position.side_to_move_;
+	MoveState state;
+	MakeMove(position, move, state);
+	Square king_square = position.KingSquare(us);
+	bool legal = king_square != Square::kNoSquare &&
+		!IsSquareAttacked(position, king_square, OppositeColor(us));
+	UndoMove(position, move, state);
+	return legal;
 }
+
+Move ParseUciMove(Position& position, std::string_view uci) {
+	Square from = Square::kNoSquare;
+	Square to = Square::kNoSquare;
+	if ((uci.size() != 4 && uci.size() != 5) || !ParseSquare(uci.substr(0, 2), from) ||
+		!ParseSquare(uci.substr(2, 2), to)) {
+		return kNoMove;
+	}
+	Piece moved = position.board_[ToIndex(from)];
+	Piece target = position.board_[ToIndex(to)];
+	if (moved == Piece::kNone) {
+		return kNoMove;
+	}
+	PieceType piece = PieceTypeFromPiece(moved);
+	PieceType capture = PieceTypeFromPiece(target);
+	PieceType promotion = PieceType::kNone;
+	MoveFlag flag = MoveFlag::kNone;
+	if (uci.size() == 5) {
+		promotion = ParsePromotion(uci[4]);
+		if (promotion == PieceType::kNone) {
+			return kNoMove;
+		}
+		flag = MoveFlag::kPromotion;
+	}
+	// The flags are implied by the squares; IsLegal rejects whatever they do not fit.
+	if (piece == PieceType::kKing && std::abs(FileOf(to) - FileOf(from)) == 2) {
+		flag = MoveFlag::kCastle;
+	} else if (piece == PieceType::kPawn && to == position.en_passant_square_ &&
+		FileOf(to) != FileOf(from)) {
+		flag = MoveFlag::kEnPassant;
+		capture = PieceType::kPawn;
+	} else if (piece == PieceType::kPawn && std::abs(RankOf(to) - RankOf(from)) == 2) {
+		flag = MoveFlag::kDoublePush;
+	}
+	Move move = EncodeMove(from, to, piece, capture, promotion, flag);
+	return IsLegal(position, move) ? move : kNoMove;
+}
+
+}
+
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <string_view>
 #include <vector>
 
+#include "attack.h"
 #include "move.h"
 #include "position.h"
 
@@ -20,6 +22,15 @@ struct MoveState {
 bool MakeMove(Position& position, Move move, MoveState& state);
 void UndoMove(Position& position, Move move, const MoveState& state);
 void GenerateLegalMoves(Position& position, std::vector<Move>& moves);
+// Uses attack maps the caller already computed for this position.
+void GenerateLegalMoves(Position& position, std::vector<Move>& moves, const AttackInfo& info);
+// Whether the move could be generated in this position, ignoring only whether it leaves the
+// own king in check.
+bool IsPseudoLegal(const Position& position, Move move);
+bool IsLegal(Position& position, Move move);
+// Decodes a move in UCI long algebraic notation against the position without generating the
+// move list. Returns kNoMove unless the move is legal.
+Move ParseUciMove(Position& position, std::string_view uci);
 
 }
 
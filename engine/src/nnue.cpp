@@ -0,0 +1,554 @@
+#include "nnue.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "bitboard.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FLARE_NNUE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace flare {
+namespace nnue {
+namespace {
+
+constexpr char kFileMagic[8] = {'F', 'L', 'A', 'R', 'E', 'N', 'N', '\0'};
+constexpr std::uint32_t kFileVersion = 1;
+
+constexpr std::size_t kFeatureWeightBytes =
+	sizeof(std::int16_t) * kFeatureCount * kHiddenSize;
+constexpr std::size_t kFeatureBiasBytes = sizeof(std::int16_t) * kHiddenSize;
+constexpr std::size_t kHiddenWeightBytes =
+	sizeof(std::int8_t) * kOutputHiddenSize * 2 * kHiddenSize;
+constexpr std::size_t kHiddenBiasBytes = sizeof(std::int32_t) * kOutputHiddenSize;
+constexpr std::size_t kOutputWeightBytes = sizeof(std::int8_t) * kOutputHiddenSize;
+constexpr std::size_t kOutputBiasBytes = sizeof(std::int32_t);
+constexpr std::size_t kPayloadBytes = kFeatureWeightBytes + kFeatureBiasBytes +
+	kHiddenWeightBytes + kHiddenBiasBytes + kOutputWeightBytes + kOutputBiasBytes;
+
+// Activations are clipped to [0, kActivationMax], which stands for [0, 1]; hidden and
+// output weights are scaled by 2^kWeightShift.
+constexpr int kActivationMax = 127;
+constexpr int kWeightShift = 6;
+constexpr int kOutputScale = 400;
+constexpr int kEvalLimit = 10000;
+
+// A move removes at most a captured piece, the moved piece and a castling rook.
+constexpr int kMaxChangedFeatures = 3;
+
+int FeatureIndex(Color perspective, Square king_square, Piece piece, Square square) {
+	int index = ToIndex(square);
+	if (perspective == Color::kBlack) {
+		index ^= 56;
+	}
+	if (king_square != Square::kNoSquare && FileOf(king_square) >= 4) {
+		index ^= 7;
+	}
+	int side = ColorFromPiece(piece) == perspective ? 0 : 1;
+	return (side * 6 + ToIndex(PieceTypeFromPiece(piece)) - 1) * kSquareCount + index;
+}
+
+using UpdateKernel = void (*)(std::int16_t* out, const std::int16_t* in,
+	const std::int16_t* weights, const int* added, int added_count, const int* removed,
+	int removed_count);
+using HiddenKernel = void (*)(const std::int16_t* us, const std::int16_t* them,
+	const Parameters& parameters, std::int32_t* out);
+
+void UpdateScalar(std::int16_t* out, const std::int16_t* in, const std::int16_t* weights,
+	const int* added, int added_count, const int* removed, int removed_count) {
+	for (int i = 0; i < kHiddenSize; ++i) {
+		int value = in[i];
+		for (int k = 0; k < added_count; ++k) {
+			value += weights[added[k] * kHiddenSize + i];
+		}
+		for (int k = 0; k < removed_count; ++k) {
+			value -= weights[removed[k] * kHiddenSize + i];
+		}
+		// Wraps like the 16-bit SIMD lanes do.
+		out[i] = static_cast<std::int16_t>(value);
+	}
+}
+
+void HiddenScalar(const std::int16_t* us, const std::int16_t* them,
+	const Parameters& parameters, std::int32_t* out) {
+	std::array<std::uint8_t, 2 * kHiddenSize> input{};
+	for (int i = 0; i < kHiddenSize; ++i) {
+		input[i] = static_cast<std::uint8_t>(std::clamp<int>(us[i], 0, kActivationMax));
+		input[kHiddenSize + i] =
+			static_cast<std::uint8_t>(std::clamp<int>(them[i], 0, kActivationMax));
+	}
+	for (int o = 0; o < kOutputHiddenSize; ++o) {
+		const std::int8_t* row = parameters.hidden_weights + o * 2 * kHiddenSize;
+		std::int32_t sum = parameters.hidden_bias[o];
+		for (int i = 0; i < 2 * kHiddenSize; ++i) {
+			sum += input[i] * row[i];
+		}
+		out[o] = sum;
+	}
+}
+
+#ifdef FLARE_NNUE_X86
+
+__attribute__((target("sse4.1")))
+void UpdateSse41(std::int16_t* out, const std::int16_t* in, const std::int16_t* weights,
+	const int* added, int added_count, const int* removed, int removed_count) {
+	for (int i = 0; i < kHiddenSize; i += 8) {
+		__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		for (int k = 0; k < added_count; ++k) {
+			value = _mm_add_epi16(value, _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(weights + added[k] * kHiddenSize + i)));
+		}
+		for (int k = 0; k < removed_count; ++k) {
+			value = _mm_sub_epi16(value, _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(weights + removed[k] * kHiddenSize + i)));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), value);
+	}
+}
+
+__attribute__((target("sse4.1")))
+int HorizontalSum(__m128i sum) {
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+	return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("sse4.1")))
+void HiddenSse41(const std::int16_t* us, const std::int16_t* them,
+	const Parameters& parameters, std::int32_t* out) {
+	alignas(16) std::array<std::uint8_t, 2 * kHiddenSize> input;
+	const __m128i limit = _mm_set1_epi8(kActivationMax);
+	for (int half = 0; half < 2; ++half) {
+		const std::int16_t* source = half == 0 ? us : them;
+		for (int i = 0; i < kHiddenSize; i += 16) {
+			__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+			__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 8));
+			__m128i packed = _mm_min_epu8(_mm_packus_epi16(low, high), limit);
+			_mm_store_si128(reinterpret_cast<__m128i*>(input.data() + half * kHiddenSize + i),
+				packed);
+		}
+	}
+	const __m128i ones = _mm_set1_epi16(1);
+	for (int o = 0; o < kOutputHiddenSize; ++o) {
+		const std::int8_t* row = parameters.hidden_weights + o * 2 * kHiddenSize;
+		__m128i sum = _mm_setzero_si128();
+		for (int i = 0; i < 2 * kHiddenSize; i += 16) {
+			__m128i activations =
+				_mm_load_si128(reinterpret_cast<const __m128i*>(input.data() + i));
+			__m128i weights = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+			__m128i products = _mm_maddubs_epi16(activations, weights);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+		}
+		out[o] = parameters.hidden_bias[o] + HorizontalSum(sum);
+	}
+}
+
+__attribute__((target("avx2")))
+void UpdateAvx2(std::int16_t* out, const std::int16_t* in, const std::int16_t* weights,
+	const int* added, int added_count, const int* removed, int removed_count) {
+	for (int i = 0; i < kHiddenSize; i += 16) {
+		__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		for (int k = 0; k < added_count; ++k) {
+			value = _mm256_add_epi16(value, _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(weights + added[k] * kHiddenSize + i)));
+		}
+		for (int k = 0; k < removed_count; ++k) {
+			value = _mm256_sub_epi16(value, _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(weights + removed[k] * kHiddenSize + i)));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), value);
+	}
+}
+
+__attribute__((target("avx2")))
+void HiddenAvx2(const std::int16_t* us, const std::int16_t* them,
+	const Parameters& parameters, std::int32_t* out) {
+	alignas(32) std::array<std::uint8_t, 2 * kHiddenSize> input;
+	const __m256i limit = _mm256_set1_epi8(kActivationMax);
+	for (int half = 0; half < 2; ++half) {
+		const std::int16_t* source = half == 0 ? us : them;
+		for (int i = 0; i < kHiddenSize; i += 32) {
+			__m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+			__m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i + 16));
+			// packus works per 128-bit lane; the permute restores source order.
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+			packed = _mm256_min_epu8(packed, limit);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(input.data() + half * kHiddenSize + i),
+				packed);
+		}
+	}
+	const __m256i ones = _mm256_set1_epi16(1);
+	for (int o = 0; o < kOutputHiddenSize; ++o) {
+		const std::int8_t* row = parameters.hidden_weights + o * 2 * kHiddenSize;
+		__m256i sum = _mm256_setzero_si256();
+		for (int i = 0; i < 2 * kHiddenSize; i += 32) {
+			__m256i activations =
+				_mm256_load_si256(reinterpret_cast<const __m256i*>(input.data() + i));
+			__m256i weights = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+			__m256i products = _mm256_maddubs_epi16(activations, weights);
+			sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+		}
+		__m128i folded = _mm_add_epi32(_mm256_castsi256_si128(sum),
+			_mm256_extracti128_si256(sum, 1));
+		out[o] = parameters.hidden_bias[o] + HorizontalSum(folded);
+	}
+}
+
+#endif
+
+UpdateKernel SelectUpdate(Kernel kernel) {
+#ifdef FLARE_NNUE_X86
+	if (kernel == Kernel::kAvx2) {
+		return UpdateAvx2;
+	}
+	if (kernel == Kernel::kSse41) {
+		return UpdateSse41;
+	}
+#endif
+	(void)kernel;
+	return UpdateScalar;
+}
+
+HiddenKernel SelectHidden(Kernel kernel) {
+#ifdef FLARE_NNUE_X86
+	if (kernel == Kernel::kAvx2) {
+		return HiddenAvx2;
+	}
+	if (kernel == Kernel::kSse41) {
+		return HiddenSse41;
+	}
+#endif
+	(void)kernel;
+	return HiddenScalar;
+}
+
+std::uint64_t SplitMix(std::uint64_t& state) {
+	std::uint64_t value = (state += 0x9E3779B97F4A7C15ULL);
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+	return value ^ (value >> 31);
+}
+
+int RandomInRange(std::uint64_t& state, int limit) {
+	return static_cast<int>(SplitMix(state) % static_cast<std::uint64_t>(2 * limit + 1)) - limit;
+}
+
+template <typename T>
+void FillRandom(std::byte* data, std::size_t count, std::uint64_t& state, int limit) {
+	for (std::size_t i = 0; i < count; ++i) {
+		T value = static_cast<T>(RandomInRange(state, limit));
+		std::memcpy(data + i * sizeof(T), &value, sizeof(T));
+	}
+}
+
+}
+
+Kernel BestKernel() {
+	if (KernelSupported(Kernel::kAvx2)) {
+		return Kernel::kAvx2;
+	}
+	if (KernelSupported(Kernel::kSse41)) {
+		return Kernel::kSse41;
+	}
+	return Kernel::kScalar;
+}
+
+bool KernelSupported(Kernel kernel) {
+	switch (kernel) {
+		case Kernel::kScalar:
+			return true;
+#ifdef FLARE_NNUE_X86
+		case Kernel::kSse41:
+			return __builtin_cpu_supports("sse4.1");
+		case Kernel::kAvx2:
+			return __builtin_cpu_supports("avx2");
+#else
+		case Kernel::kSse41:
+		case Kernel::kAvx2:
+			return false;
+#endif
+	}
+	return false;
+}
+
+std::string_view KernelName(Kernel kernel) {
+	switch (kernel) {
+		case Kernel::kScalar:
+			return "scalar";
+		case Kernel::kSse41:
+			return "sse4.1";
+		case Kernel::kAvx2:
+			return "avx2";
+	}
+	return "unknown";
+}
+
+Network::Network() : kernel_(BestKernel()) {}
+
+bool Network::Load(const std::string& path) {
+	MappedFile file;
+	if (!file.OpenReadOnly(path) || file.Size() != sizeof(FileHeader) + kPayloadBytes) {
+		return false;
+	}
+	FileHeader header;
+	std::memcpy(&header, file.Data(), sizeof(header));
+	if (!ValidHeader(header)) {
+		return false;
+	}
+	mapping_ = std::move(file);
+	owned_.clear();
+	Bind(mapping_.Data() + sizeof(FileHeader));
+	return true;
+}
+
+bool Network::Save(const std::string& path) const {
+	if (!loaded_) {
+		return false;
+	}
+	std::ofstream output(path, std::ios::binary | std::ios::trunc);
+	if (!output) {
+		return false;
+	}
+	FileHeader header = MakeHeader();
+	output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	output.write(reinterpret_cast<const char*>(parameters_.feature_weights),
+		static_cast<std::streamsize>(kPayloadBytes));
+	return static_cast<bool>(output);
+}
+
+void Network::Randomize(std::uint64_t seed) {
+	std::vector<std::byte> payload(kPayloadBytes);
+	std::uint64_t state = seed;
+	std::byte* cursor = payload.data();
+	FillRandom<std::int16_t>(cursor, kFeatureCount * kHiddenSize, state, 8);
+	cursor += kFeatureWeightBytes;
+	FillRandom<std::int16_t>(cursor, kHiddenSize, state, 16);
+	cursor += kFeatureBiasBytes;
+	FillRandom<std::int8_t>(cursor, kOutputHiddenSize * 2 * kHiddenSize, state, 24);
+	cursor += kHiddenWeightBytes;
+	FillRandom<std::int32_t>(cursor, kOutputHiddenSize, state, 2048);
+	cursor += kHiddenBiasBytes;
+	FillRandom<std::int8_t>(cursor, kOutputHiddenSize, state, 64);
+	cursor += kOutputWeightBytes;
+	FillRandom<std::int32_t>(cursor, 1, state, 2048);
+
+	mapping_.Close();
+	owned_ = std::move(payload);
+	Bind(owned_.data());
+}
+
+bool Network::IsLoaded() const {
+	return loaded_;
+}
+
+std::uint64_t Network::Fingerprint() const {
+	return fingerprint_;
+}
+
+bool Network::SetKernel(Kernel kernel) {
+	if (!KernelSupported(kernel)) {
+		return false;
+	}
+	kernel_ = kernel;
+	return true;
+}
+
+Kernel Network::ActiveKernel() const {
+	return kernel_;
+}
+
+void Network::Refresh(const Position& position, Color perspective,
+	AccumulatorValues& out) const {
+	std::array<int, 32> features{};
+	int count = 0;
+	Square king_square = position.KingSquare(perspective);
+	Bitboard pieces = position.all_occupancy_bb_;
+	while (pieces) {
+		Square square = static_cast<Square>(PopLsb(pieces));
+		features[count++] = FeatureIndex(perspective, king_square, position.board_[ToIndex(square)],
+			square);
+		if (count == static_cast<int>(features.size())) {
+			break;
+		}
+	}
+	SelectUpdate(kernel_)(out.data(), parameters_.feature_bias, parameters_.feature_weights,
+		features.data(), count, nullptr, 0);
+}
+
+void Network::Update(const AccumulatorValues& parent, AccumulatorValues& out,
+	Color perspective, Square king_square, const DirtyPiece* dirty, int dirty_count) const {
+	std::array<int, kMaxChangedFeatures> added{};
+	std::array<int, kMaxChangedFeatures> removed{};
+	int added_count = 0;
+	int removed_count = 0;
+	for (int i = 0; i < dirty_count; ++i) {
+		if (dirty[i].from != Square::kNoSquare) {
+			removed[removed_count++] =
+				FeatureIndex(perspective, king_square, dirty[i].piece, dirty[i].from);
+		}
+		if (dirty[i].to != Square::kNoSquare) {
+			added[added_count++] =
+				FeatureIndex(perspective, king_square, dirty[i].piece, dirty[i].to);
+		}
+	}
+	SelectUpdate(kernel_)(out.data(), parent.data(), parameters_.feature_weights, added.data(),
+		added_count, removed.data(), removed_count);
+}
+
+int Network::Propagate(const AccumulatorValues& us, const AccumulatorValues& them) const {
+	std::array<std::int32_t, kOutputHiddenSize> hidden{};
+	SelectHidden(kernel_)(us.data(), them.data(), parameters_, hidden.data());
+	std::int32_t output = *parameters_.output_bias;
+	for (int o = 0; o < kOutputHiddenSize; ++o) {
+		int activation = std::clamp(hidden[o] >> kWeightShift, 0, kActivationMax);
+		output += activation * parameters_.output_weights[o];
+	}
+	int score = output * kOutputScale / (kActivationMax << kWeightShift);
+	return std::clamp(score, -kEvalLimit, kEvalLimit);
+}
+
+Network::FileHeader Network::MakeHeader() {
+	FileHeader header{};
+	std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+	header.version = kFileVersion;
+	header.feature_count = kFeatureCount;
+	header.hidden_size = kHiddenSize;
+	header.output_hidden_size = kOutputHiddenSize;
+	header.payload_size = kPayloadBytes;
+	return header;
+}
+
+bool Network::ValidHeader(const FileHeader& header) {
+	return std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) == 0 &&
+		header.version == kFileVersion && header.feature_count == kFeatureCount &&
+		header.hidden_size == kHiddenSize && header.output_hidden_size == kOutputHiddenSize &&
+		header.payload_size == kPayloadBytes;
+}
+
+void Network::Bind(const std::byte* payload) {
+	const std::byte* cursor = payload;
+	parameters_.feature_weights = reinterpret_cast<const std::int16_t*>(cursor);
+	cursor += kFeatureWeightBytes;
+	parameters_.feature_bias = reinterpret_cast<const std::int16_t*>(cursor);
+	cursor += kFeatureBiasBytes;
+	parameters_.hidden_weights = reinterpret_cast<const std::int8_t*>(cursor);
+	cursor += kHiddenWeightBytes;
+	parameters_.hidden_bias = reinterpret_cast<const std::int32_t*>(cursor);
+	cursor += kHiddenBiasBytes;
+	parameters_.output_weights = reinterpret_cast<const std::int8_t*>(cursor);
+	cursor += kOutputWeightBytes;
+	parameters_.output_bias = reinterpret_cast<const std::int32_t*>(cursor);
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+	for (std::size_t index = 0; index < kPayloadBytes; ++index) {
+		hash = (hash ^ std::to_integer<std::uint64_t>(payload[index])) * 0x100000001b3ULL;
+	}
+	fingerprint_ = hash == 0 ? 1 : hash;
+	loaded_ = true;
+}
+
+AccumulatorStack::AccumulatorStack() : stack_(128) {
+	Reset();
+}
+
+void AccumulatorStack::Reset() {
+	top_ = 0;
+	stack_[0].computed = {};
+	stack_[0].refresh = {true, true};
+	stack_[0].dirty_count = 0;
+}
+
+void AccumulatorStack::Push(const Position& position, Move move) {
+	if (++top_ == stack_.size()) {
+		stack_.emplace_back();
+	}
+	Accumulator& entry = stack_[top_];
+	entry.computed = {};
+	entry.refresh = {};
+	entry.dirty_count = 0;
+	if (move == kNoMove) {
+		return;
+	}
+
+	Square from = FromSquare(move);
+	Square to = ToSquare(move);
+	MoveFlag flag = MoveFlagOf(move);
+	Color us = position.side_to_move_;
+	Piece moved = position.board_[ToIndex(from)];
+
+	Square captured_square = Square::kNoSquare;
+	if (flag == MoveFlag::kEnPassant) {
+		captured_square = MakeSquare(FileOf(to), RankOf(to) + (us == Color::kWhite ? -1 : 1));
+	} else if (position.board_[ToIndex(to)] != Piece::kNone) {
+		captured_square = to;
+	}
+	if (captured_square != Square::kNoSquare) {
+		entry.dirty[entry.dirty_count++] =
+			{position.board_[ToIndex(captured_square)], captured_square, Square::kNoSquare};
+	}
+
+	if (flag == MoveFlag::kPromotion) {
+		entry.dirty[entry.dirty_count++] = {moved, from, Square::kNoSquare};
+		entry.dirty[entry.dirty_count++] =
+			{MakePiece(us, PromotionPiece(move)), Square::kNoSquare, to};
+	} else {
+		entry.dirty[entry.dirty_count++] = {moved, from, to};
+	}
+
+	if (flag == MoveFlag::kCastle) {
+		bool king_side = FileOf(to) > FileOf(from);
+		int rank = RankOf(from);
+		entry.dirty[entry.dirty_count++] = {MakePiece(us, PieceType::kRook),
+			MakeSquare(king_side ? 7 : 0, rank), MakeSquare(king_side ? 5 : 3, rank)};
+	}
+
+	if (PieceTypeFromPiece(moved) == PieceType::kKing &&
+		(FileOf(from) >= 4) != (FileOf(to) >= 4)) {
+		entry.refresh[ToIndex(us)] = true;
+	}
+}
+
+void AccumulatorStack::Pop() {
+	--top_;
+}
+
+int AccumulatorStack::Evaluate(const Position& position, const Network& network) {
+	Materialize(position, network, Color::kWhite);
+	Materialize(position, network, Color::kBlack);
+	const Accumulator& entry = stack_[top_];
+	Color us = position.side_to_move_;
+	return network.Propagate(entry.values[ToIndex(us)],
+		entry.values[ToIndex(OppositeColor(us))]);
+}
+
+void AccumulatorStack::Materialize(const Position& position, const Network& network,
+	Color perspective) {
+	int index = ToIndex(perspective);
+	if (stack_[top_].computed[index]) {
+		return;
+	}
+	// Entry 0 is always computed or marked for refresh, so the walk terminates.
+	std::size_t start = top_;
+	while (!stack_[start].computed[index] && !stack_[start].refresh[index]) {
+		--start;
+	}
+	if (!stack_[start].computed[index]) {
+		network.Refresh(position, perspective, stack_[top_].values[index]);
+		stack_[top_].computed[index] = true;
+		return;
+	}
+	// No refresh in between, so the king stayed on the same half and mirroring is stable.
+	Square king_square = position.KingSquare(perspective);
+	for (std::size_t ply = start + 1; ply <= top_; ++ply) {
+		Accumulator& entry = stack_[ply];
+		network.Update(stack_[ply - 1].values[index], entry.values[index], perspective,
+			king_square, entry.dirty.data(), entry.dirty_count);
+		entry.computed[index] = true;
+	}
+}
+
+}
+}
+
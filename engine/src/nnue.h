@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.h"
+#include "move.h"
+#include "position.h"
+
+namespace flare {
+namespace nnue {
+
+// 768 inputs per perspective: (own/enemy, piece type, square), with the board mirrored
+// so the perspective's king always sits on files a-d.
+constexpr int kFeatureCount = 2 * 6 * kSquareCount;
+constexpr int kHiddenSize = 256;
+constexpr int kOutputHiddenSize = 16;
+
+// The scalar kernel is always available and is the reference the SIMD kernels must
+// match bit for bit.
+enum class Kernel : std::uint8_t {
+	kScalar,
+	kSse41,
+	kAvx2,
+};
+
+Kernel BestKernel();
+bool KernelSupported(Kernel kernel);
+std::string_view KernelName(Kernel kernel);
+
+// Views into a network's parameter block.
+struct Parameters {
+	const std::int16_t* feature_weights = nullptr;
+	const std::int16_t* feature_bias = nullptr;
+	const std::int8_t* hidden_weights = nullptr;
+	const std::int32_t* hidden_bias = nullptr;
+	const std::int8_t* output_weights = nullptr;
+	const std::int32_t* output_bias = nullptr;
+};
+
+struct DirtyPiece {
+	Piece piece = Piece::kNone;
+	Square from = Square::kNoSquare;
+	Square to = Square::kNoSquare;
+};
+
+using AccumulatorValues = std::array<std::int16_t, kHiddenSize>;
+
+class Network {
+public:
+	Network();
+
+	Network(const Network&) = delete;
+	Network& operator=(const Network&) = delete;
+
+	// Network files are a versioned header followed by the raw parameters; they are
+	// mapped read-only and used in place.
+	bool Load(const std::string& path);
+	bool Save(const std::string& path) const;
+	// Fills an owned parameter block with small random weights, for tests and tooling.
+	void Randomize(std::uint64_t seed);
+	bool IsLoaded() const;
+	// Hash of the parameters, never zero, telling networks apart.
+	std::uint64_t Fingerprint() const;
+
+	bool SetKernel(Kernel kernel);
+	Kernel ActiveKernel() const;
+
+	void Refresh(const Position& position, Color perspective, AccumulatorValues& out) const;
+	void Update(const AccumulatorValues& parent, AccumulatorValues& out, Color perspective,
+		Square king_square, const DirtyPiece* dirty, int dirty_count) const;
+	// Centipawns from the point of view of the side owning the first accumulator.
+	int Propagate(const AccumulatorValues& us, const AccumulatorValues& them) const;
+
+private:
+	struct FileHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t feature_count;
+		std::uint32_t hidden_size;
+		std::uint32_t output_hidden_size;
+		std::uint64_t payload_size;
+		std::uint8_t reserved[32];
+	};
+
+	static FileHeader MakeHeader();
+	static bool ValidHeader(const FileHeader& header);
+	void Bind(const std::byte* payload);
+
+	Parameters parameters_;
+	Kernel kernel_ = Kernel::kScalar;
+	bool loaded_ = false;
+	std::uint64_t fingerprint_ = 0;
+	std::vector<std::byte> owned_;
+	MappedFile mapping_;
+};
+
+struct Accumulator {
+	alignas(64) std::array<AccumulatorValues, kColorCount> values{};
+	std::array<bool, kColorCount> computed{};
+	// Set when the perspective's king crossed the mirroring boundary on this ply.
+	std::array<bool, kColorCount> refresh{};
+	std::array<DirtyPiece, 3> dirty{};
+	int dirty_count = 0;
+};
+
+// One accumulator per ply of the current line. Push records the pieces a move touches and
+// Evaluate brings the top entry up to date lazily, from the nearest computed ancestor or
+// with a full refresh after a king crossed between the d and e files.
+class AccumulatorStack {
+public:
+	AccumulatorStack();
+
+	void Reset();
+	// Call before MakeMove with the position the move is played from; kNoMove records a
+	// null move.
+	void Push(const Position& position, Move move);
+	void Pop();
+	int Evaluate(const Position& position, const Network& network);
+
+private:
+	void Materialize(const Position& position, const Network& network, Color perspective);
+
+	std::vector<Accumulator> stack_;
+	std::size_t top_ = 0;
+};
+
+}
+}
+
@@ -0,0 +1,183 @@
+#include "pawns.h"
+
+#include <algorithm>
+
+#include "attack.h"
+#include "bitboard.h"
+
+namespace flare {
+namespace {
+
+constexpr Score kDoubledPenalty = MakeScore(12, 20);
+constexpr Score kIsolatedPenalty = MakeScore(10, 12);
+constexpr Score kBackwardPenalty = MakeScore(8, 10);
+constexpr std::array<Score, kRankCount> kPassedBonus = {
+	MakeScore(0, 0), MakeScore(5, 10), MakeScore(10, 15), MakeScore(15, 30),
+	MakeScore(25, 50), MakeScore(40, 85), MakeScore(70, 135), MakeScore(0, 0),
+};
+constexpr int kShieldNear = 12;
+constexpr int kShieldFar = 6;
+
+consteval std::array<Bitboard, kFileCount> MakeFileMasks() {
+	std::array<Bitboard, kFileCount> masks{};
+	for (int file = 0; file < kFileCount; ++file) {
+		for (int rank = 0; rank < kRankCount; ++rank) {
+			masks[file] |= Bitboard{1} << (rank * kFileCount + file);
+		}
+	}
+	return masks;
+}
+
+consteval std::array<Bitboard, kRankCount> MakeRankMasks() {
+	std::array<Bitboard, kRankCount> masks{};
+	for (int rank = 0; rank < kRankCount; ++rank) {
+		masks[rank] = Bitboard{0xFF} << (rank * kFileCount);
+	}
+	return masks;
+}
+
+constexpr auto kFileMasks = MakeFileMasks();
+constexpr auto kRankMasks = MakeRankMasks();
+
+consteval std::array<Bitboard, kFileCount> MakeAdjacentFileMasks() {
+	std::array<Bitboard, kFileCount> masks{};
+	for (int file = 0; file < kFileCount; ++file) {
+		if (file > 0) {
+			masks[file] |= kFileMasks[file - 1];
+		}
+		if (file < kFileCount - 1) {
+			masks[file] |= kFileMasks[file + 1];
+		}
+	}
+	return masks;
+}
+
+// Ranks strictly in front of the given rank from each side's point of view.
+consteval std::array<std::array<Bitboard, kRankCount>, kColorCount> MakeForwardRanks() {
+	std::array<std::array<Bitboard, kRankCount>, kColorCount> masks{};
+	for (int rank = 0; rank < kRankCount; ++rank) {
+		for (int other = 0; other < kRankCount; ++other) {
+			if (other > rank) {
+				masks[ToIndex(Color::kWhite)][rank] |= kRankMasks[other];
+			} else if (other < rank) {
+				masks[ToIndex(Color::kBlack)][rank] |= kRankMasks[other];
+			}
+		}
+	}
+	return masks;
+}
+
+constexpr auto kAdjacentFileMasks = MakeAdjacentFileMasks();
+constexpr auto kForwardRanks = MakeForwardRanks();
+
+int RelativeRank(Color color, int rank) {
+	return color == Color::kWhite ? rank : kRankCount - 1 - rank;
+}
+
+Score EvaluateSide(const Position& position, Color color, Bitboard& passed) {
+	int us = ToIndex(color);
+	int them = ToIndex(OppositeColor(color));
+	Bitboard ours = position.piece_bb_[us][ToIndex(PieceType::kPawn)];
+	Bitboard theirs = position.piece_bb_[them][ToIndex(PieceType::kPawn)];
+	int forward = color == Color::kWhite ? 1 : -1;
+
+	Score score = 0;
+	Bitboard remaining = ours;
+	while (remaining) {
+		int square_index = PopLsb(remaining);
+		Square square = static_cast<Square>(square_index);
+		int file = FileOf(square);
+		int rank = RankOf(square);
+		Bitboard ahead = kForwardRanks[us][rank];
+		Bitboard adjacent = kAdjacentFileMasks[file];
+
+		bool doubled = (ours & kFileMasks[file] & ahead) != 0;
+		bool isolated = (ours & adjacent) == 0;
+		if (doubled) {
+			score -= kDoubledPenalty;
+		}
+		if (isolated) {
+			score -= kIsolatedPenalty;
+		} else if ((ours & adjacent & ~ahead) == 0) {
+			// No neighbour level or behind can ever defend it; backward once the stop
+			// square is covered by an enemy pawn.
+			int stop_rank = rank + forward;
+			if (stop_rank >= 0 && stop_rank < kRankCount &&
+				(PawnAttacks(color, MakeSquare(file, stop_rank)) & theirs) != 0) {
+				score -= kBackwardPenalty;
+			}
+		}
+		if (!doubled && (theirs & (kFileMasks[file] | adjacent) & ahead) == 0) {
+			passed |= SquareBit(square);
+			score += kPassedBonus[RelativeRank(color, rank)];
+		}
+	}
+	return score;
+}
+
+}
+
+void EvaluatePawnStructure(const Position& position, PawnEntry& entry) {
+	entry.key = position.pawn_hash_;
+	entry.passed = {};
+	entry.shield_king = {Square::kNoSquare, Square::kNoSquare};
+	entry.shield = {};
+	entry.score = EvaluateSide(position, Color::kWhite, entry.passed[ToIndex(Color::kWhite)]) -
+		EvaluateSide(position, Color::kBlack, entry.passed[ToIndex(Color::kBlack)]);
+}
+
+int KingShield(const Position& position, PawnEntry& entry, Color color) {
+	int us = ToIndex(color);
+	Square king_square = position.KingSquare(color);
+	if (entry.shield_king[us] == king_square) {
+		return entry.shield[us];
+	}
+	int shield = 0;
+	if (king_square != Square::kNoSquare && RelativeRank(color, RankOf(king_square)) <= 1) {
+		Bitboard ours = position.piece_bb_[us][ToIndex(PieceType::kPawn)];
+		int file = FileOf(king_square);
+		int rank = RankOf(king_square);
+		int forward = color == Color::kWhite ? 1 : -1;
+		Bitboard files = kFileMasks[file] | kAdjacentFileMasks[file];
+		int near_rank = rank + forward;
+		int far_rank = rank + 2 * forward;
+		if (near_rank >= 0 && near_rank < kRankCount) {
+			shield += kShieldNear * std::popcount(ours & files & kRankMasks[near_rank]);
+		}
+		if (far_rank >= 0 && far_rank < kRankCount) {
+			shield += kShieldFar * std::popcount(ours & files & kRankMasks[far_rank]);
+		}
+	}
+	entry.shield_king[us] = king_square;
+	entry.shield[us] = shield;
+	return shield;
+}
+
+PawnTable::PawnTable() : entries_(kEntryCount) {}
+
+void PawnTable::Clear() {
+	std::fill(entries_.begin(), entries_.end(), PawnEntry{});
+	probes_ = 0;
+	hits_ = 0;
+}
+
+PawnEntry& PawnTable::Probe(const Position& position) {
+	++probes_;
+	PawnEntry& entry = entries_[position.pawn_hash_ & (kEntryCount - 1)];
+	if (entry.key == position.pawn_hash_) {
+		++hits_;
+		return entry;
+	}
+	EvaluatePawnStructure(position, entry);
+	return entry;
+}
+
+std::uint64_t PawnTable::Probes() const {
+	return probes_;
+}
+
+std::uint64_t PawnTable::Hits() const {
+	return hits_;
+}
+
+}
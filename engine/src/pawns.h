@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "position.h"
+#include "score.h"
+
+namespace flare {
+
+struct PawnEntry {
+	std::uint64_t key = 0;
+	Score score = 0;
+	std::array<Bitboard, kColorCount> passed{};
+	std::array<Square, kColorCount> shield_king{Square::kNoSquare, Square::kNoSquare};
+	std::array<int, kColorCount> shield{};
+};
+
+// Scores are from white's point of view. The king shield is a midgame-only term that
+// depends on the king square as well, so it is cached per entry for the last king square
+// seen.
+void EvaluatePawnStructure(const Position& position, PawnEntry& entry);
+int KingShield(const Position& position, PawnEntry& entry, Color color);
+
+class PawnTable {
+public:
+	PawnTable();
+
+	void Clear();
+	PawnEntry& Probe(const Position& position);
+	std::uint64_t Probes() const;
+	std::uint64_t Hits() const;
+
+private:
+	static constexpr std::size_t kEntryCount = 1 << 13;
+
+	std::vector<PawnEntry> entries_;
+	std::uint64_t probes_ = 0;
+	std::uint64_t hits_ = 0;
+};
+
+}
+
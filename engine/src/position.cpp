@@ -1,6 +1,9 @@
 #include "position.h"
 
+#include <algorithm>
+
 #include "bitboard.h"
+#include "psqt.h"
 #include "zobrist.h"
 
 namespace flare {
@@ -21,7 +24,11 @@ void Position::Clear() {
 	en_passant_square_ = Square::kNoSquare;
 	halfmove_clock_ = 0;
 	fullmove_number_ = 1;
+	history_.clear();
 	ComputeHash();
+	ComputePawnHash();
+	ComputePsq();
+	ComputeMaterialKey();
 }
 
 void Position::SetStartPosition() {
@@ -55,6 +62,23 @@ void Position::SetStartPosition() {
 	RebuildBitboards();
 }
 
+bool Position::IsDraw(int ply) const {
+	if (halfmove_clock_ >= 100) {
+		return true;
+	}
+	int reach = std::min<int>(halfmove_clock_, static_cast<int>(history_.size()));
+	int repetitions = 0;
+	for (int distance = 4; distance <= reach; distance += 2) {
+		if (history_[history_.size() - static_cast<std::size_t>(distance)] != hash_) {
+			continue;
+		}
+		if (distance < ply || ++repetitions == 2) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void Position::RebuildBitboards() {
 	for (auto& color_bb : piece_bb_) {
 		color_bb.fill(Bitboard{0});
@@ -76,6 +100,9 @@ void Position::RebuildBitboards() {
 	}
 
 	ComputeHash();
+	ComputePawnHash();
+	ComputePsq();
+	ComputeMaterialKey();
 }
 
 void Position::PlacePiece(Piece piece, Square square) {
@@ -89,6 +116,13 @@ void Position::PlacePiece(Piece piece, Square square) {
 	piece_bb_[ToIndex(color)][ToIndex(type)] |= bit;
 	occupancy_bb_[ToIndex(color)] |= bit;
 	all_occupancy_bb_ |= bit;
+	if (type == PieceType::kPawn) {
+		pawn_hash_ ^= Zobrist::Instance().PieceSquare()[ToIndex(piece)][ToIndex(square)];
+	}
+	material_key_ ^= Zobrist::Instance().Material()[ToIndex(piece)]
+		[std::popcount(piece_bb_[ToIndex(color)][ToIndex(type)]) - 1];
+	psq_ += kPsq[ToIndex(piece)][ToIndex(square)];
+	phase_ += kPhaseWeight[ToIndex(type)];
 }
 
 void Position::RemovePiece(Square square) {
@@ -103,6 +137,13 @@ void Position::RemovePiece(Square square) {
 	piece_bb_[ToIndex(color)][ToIndex(type)] &= ~bit;
 	occupancy_bb_[ToIndex(color)] &= ~bit;
 	all_occupancy_bb_ &= ~bit;
+	if (type == PieceType::kPawn) {
+		pawn_hash_ ^= Zobrist::Instance().PieceSquare()[ToIndex(piece)][ToIndex(square)];
+	}
+	material_key_ ^= Zobrist::Instance().Material()[ToIndex(piece)]
+		[std::popcount(piece_bb_[ToIndex(color)][ToIndex(type)])];
+	psq_ -= kPsq[ToIndex(piece)][ToIndex(square)];
+	phase_ -= kPhaseWeight[ToIndex(type)];
 }
 
 void Position::MovePiece(Square from, Square to) {
@@ -140,4 +181,45 @@ void Position::ComputeHash() {
 	hash_ = hash;
 }
 
+void Position::ComputePawnHash() {
+	const auto& zobrist = Zobrist::Instance();
+	std::uint64_t hash = 0;
+	for (Color color : {Color::kWhite, Color::kBlack}) {
+		Piece piece = MakePiece(color, PieceType::kPawn);
+		Bitboard pawns = piece_bb_[ToIndex(color)][ToIndex(PieceType::kPawn)];
+		while (pawns) {
+			int square_index = PopLsb(pawns);
+			hash ^= zobrist.PieceSquare()[ToIndex(piece)][square_index];
+		}
+	}
+	pawn_hash_ = hash;
 }
+
+void Position::ComputePsq() {
+	psq_ = 0;
+	phase_ = 0;
+	for (int square_index = 0; square_index < kSquareCount; ++square_index) {
+		Piece piece = board_[square_index];
+		psq_ += kPsq[ToIndex(piece)][square_index];
+		phase_ += kPhaseWeight[ToIndex(PieceTypeFromPiece(piece))];
+	}
+}
+
+void Position::ComputeMaterialKey() {
+	const auto& zobrist = Zobrist::Instance();
+	std::uint64_t key = 0;
+	for (Color color : {Color::kWhite, Color::kBlack}) {
+		for (int type_index = ToIndex(PieceType::kPawn); type_index <= ToIndex(PieceType::kKing);
+			++type_index) {
+			Piece piece = MakePiece(color, static_cast<PieceType>(type_index));
+			int count = std::popcount(piece_bb_[ToIndex(color)][type_index]);
+			for (int index = 0; index < count; ++index) {
+				key ^= zobrist.Material()[ToIndex(piece)][index];
+			}
+		}
+	}
+	material_key_ = key;
+}
+
+}
+
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <array>
+#include <vector>
 
+#include "score.h"
 #include "types.h"
 
 namespace flare {
@@ -17,6 +19,13 @@ struct Position {
 	void MovePiece(Square from, Square to);
 	Square KingSquare(Color color) const;
 	void ComputeHash();
+	void ComputePawnHash();
+	void ComputePsq();
+	void ComputeMaterialKey();
+	// Fifty-move rule or repetition. A position repeated within the last `ply` plies, which
+	// the search played itself, is a draw at once; older repetitions need a third occurrence.
+	// A mate delivered on the hundredth ply is missed, which is not worth a move generation.
+	bool IsDraw(int ply) const;
 
 	std::array<Piece, kSquareCount> board_{};
 	std::array<std::array<Bitboard, kPieceTypeCount>, kColorCount> piece_bb_{};
@@ -28,6 +37,18 @@ struct Position {
 	std::uint16_t halfmove_clock_ = 0;
 	std::uint16_t fullmove_number_ = 1;
 	std::uint64_t hash_ = 0;
+	// Zobrist key over pawns only, maintained incrementally by PlacePiece/RemovePiece.
+	std::uint64_t pawn_hash_ = 0;
+	// Zobrist key over piece counts only, so positions with the same material share it.
+	std::uint64_t material_key_ = 0;
+	// Running material plus piece-square sum from white's point of view, as a packed
+	// midgame/endgame pair.
+	Score psq_ = 0;
+	// Non-pawn material phase, kMaxPhase at the start and falling towards 0 in endings.
+	int phase_ = 0;
+	// Keys of the positions before each move made, oldest first. MakeMove pushes and UndoMove
+	// pops; repetitions are only looked for back to the last irreversible move.
+	std::vector<std::uint64_t> history_;
 };
 
 }
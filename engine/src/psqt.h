@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+
+#include "score.h"
+#include "types.h"
+
+namespace flare {
+
+inline constexpr std::array<int, kPieceTypeCount> kPieceValueMidgame = {
+	0,    // kNone
+	100,  // kPawn
+	320,  // kKnight
+	330,  // kBishop
+	500,  // kRook
+	900,  // kQueen
+	0,    // kKing
+};
+
+inline constexpr std::array<int, kPieceTypeCount> kPieceValueEndgame = {
+	0,    // kNone
+	130,  // kPawn
+	300,  // kKnight
+	320,  // kBishop
+	520,  // kRook
+	950,  // kQueen
+	0,    // kKing
+};
+
+// Game phase contributed by each piece type; the starting position sums to kMaxPhase.
+inline constexpr std::array<int, kPieceTypeCount> kPhaseWeight = {0, 0, 1, 1, 2, 4, 0};
+inline constexpr int kMaxPhase = 24;
+
+using PsqTable = std::array<std::array<Score, kSquareCount>, kPieceCount>;
+
+namespace psqt {
+
+constexpr std::array<int, kFileCount> kCenterFile = {0, 1, 2, 3, 3, 2, 1, 0};
+constexpr std::array<int, kRankCount> kCenterRank = {0, 1, 2, 3, 3, 2, 1, 0};
+constexpr std::array<int, kRankCount> kPawnRank = {0, 4, 8, 12, 16, 20, 24, 0};
+constexpr std::array<int, kRankCount> kPawnRankEndgame = {0, 6, 12, 20, 30, 45, 65, 0};
+constexpr std::array<int, kRankCount> kRookRank = {0, 1, 2, 2, 3, 4, 6, 0};
+
+consteval int PstMidgame(PieceType type, int file, int rank) {
+	switch (type) {
+		case PieceType::kPawn:
+			return kPawnRank[rank] + kCenterFile[file];
+		case PieceType::kKnight:
+			return (kCenterFile[file] + kCenterRank[rank]) * 4;
+		case PieceType::kBishop:
+			return (kCenterFile[file] + kCenterRank[rank]) * 3;
+		case PieceType::kRook:
+			return kRookRank[rank] + kCenterFile[file];
+		case PieceType::kQueen:
+			return (kCenterFile[file] + kCenterRank[rank]) * 2;
+		case PieceType::kKing:
+			return -(kCenterFile[file] + kCenterRank[rank]) * 5;
+		case PieceType::kNone:
+			return 0;
+	}
+	return 0;
+}
+
+// Endgame squares: pawns are worth more as they advance, and the king stops hiding and
+// heads for the centre.
+consteval int PstEndgame(PieceType type, int file, int rank) {
+	switch (type) {
+		case PieceType::kPawn:
+			return kPawnRankEndgame[rank];
+		case PieceType::kKnight:
+			return (kCenterFile[file] + kCenterRank[rank]) * 3;
+		case PieceType::kBishop:
+			return (kCenterFile[file] + kCenterRank[rank]) * 2;
+		case PieceType::kRook:
+			return kRookRank[rank];
+		case PieceType::kQueen:
+			return (kCenterFile[file] + kCenterRank[rank]) * 2;
+		case PieceType::kKing:
+			return (kCenterFile[file] + kCenterRank[rank]) * 6;
+		case PieceType::kNone:
+			return 0;
+	}
+	return 0;
+}
+
+// Material plus square bonus for every piece, signed from white's point of view with
+// black squares mirrored, so a position's score is the plain sum over its pieces.
+consteval PsqTable MakePsqTable() {
+	PsqTable table{};
+	for (int piece_index = 1; piece_index < kPieceCount; ++piece_index) {
+		Piece piece = static_cast<Piece>(piece_index);
+		PieceType type = PieceTypeFromPiece(piece);
+		int type_index = ToIndex(type);
+		bool white = ColorFromPiece(piece) == Color::kWhite;
+		for (int rank = 0; rank < kRankCount; ++rank) {
+			for (int file = 0; file < kFileCount; ++file) {
+				int relative_rank = white ? rank : kRankCount - 1 - rank;
+				int midgame = kPieceValueMidgame[type_index] + PstMidgame(type, file, relative_rank);
+				int endgame = kPieceValueEndgame[type_index] + PstEndgame(type, file, relative_rank);
+				table[piece_index][rank * kFileCount + file] =
+					white ? MakeScore(midgame, endgame) : MakeScore(-midgame, -endgame);
+			}
+		}
+	}
+	return table;
+}
+
+}
+
+inline constexpr auto kPsq = psqt::MakePsqTable();
+
+}
+
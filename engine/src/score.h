@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+namespace flare {
+
+// A midgame/endgame score pair packed into one integer: the endgame half lives in the
+// upper 16 bits and the midgame half in the lower 16, so pairs add and subtract with
+// plain integer arithmetic.
+using Score = int;
+
+constexpr Score MakeScore(int midgame, int endgame) {
+	return static_cast<Score>(static_cast<std::uint32_t>(endgame) << 16) + midgame;
+}
+
+constexpr int MidgameValue(Score score) {
+	return static_cast<std::int16_t>(static_cast<std::uint16_t>(static_cast<std::uint32_t>(score)));
+}
+
+// Rounds by half a unit so a negative midgame half's borrow is cancelled out.
+constexpr int EndgameValue(Score score) {
+	return static_cast<std::int16_t>(
+		static_cast<std::uint16_t>((static_cast<std::uint32_t>(score) + 0x8000) >> 16));
+}
+
+}
+
@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "attack.h"
+#include "bitboard.h"
 #include "eval.h"
 #include "movegen.h"
 
@@ -21,19 +22,37 @@ constexpr int kMateScore = 30000;
 constexpr int kMateThreshold = 29000;
 constexpr int kMaxPly = 64;
 constexpr int kHistoryMax = 1'000'000;
+// MultiPV lines after the first search a window around their score from the last iteration.
+constexpr int kAspirationDepth = 4;
+constexpr int kAspirationMargin = 50;
+// go mate leaves 1/kMateFallbackShare of a node or time budget to the normal search that
+// follows a mate search without result.
+constexpr int kMateFallbackShare = 4;
+// The alpha-beta mate prover follows up a quiet attacking move only when it leaves the
+// defender at most this many replies.
+constexpr std::size_t kMateQuietReplies = 3;
+// Positions the mate prover remembers as refuted, always replacing.
+constexpr std::size_t kRefutedSlots = std::size_t{1} << 16;
 
 struct SearchContext {
 	TranspositionTable& table;
+	EvalContext& eval;
 	std::uint64_t nodes = 0;
+	TranspositionStats tt_stats{};
 	std::array<std::array<Move, 2>, kMaxPly> killers{};
 	std::array<std::array<int, kSquareCount>, kSquareCount> history{};
 	std::atomic<bool>* stop = nullptr;
-	std::chrono::steady_clock::time_point deadline{};
+	// Only read, for a search phase whose own stop flag must not end the caller's search.
+	const std::atomic<bool>* caller_stop = nullptr;
+	TimeManager* time = nullptr;
+	// This thread's share of a go nodes budget; zero for none.
+	std::uint64_t node_limit = 0;
 };
 
 struct NullState {
 	Square en_passant_square = Square::kNoSquare;
 	Color side_to_move = Color::kWhite;
+	std::uint16_t halfmove_clock = 0;
 };
 
 constexpr std::array<int, kPieceTypeCount> kMoveValues = {
@@ -66,6 +85,7 @@ int ScoreFromTt(int score, int ply) {
 	return score;
 }
 
+// Checked before a node is counted, so a node budget is never passed.
 bool ShouldStop(SearchContext& context) {
 	if (!context.stop) {
 		return false;
@@ -73,10 +93,19 @@ bool ShouldStop(SearchContext& context) {
 	if (context.stop->load(std::memory_order_relaxed)) {
 		return true;
 	}
-	if ((context.nodes & 4095) != 0) {
+	if (context.caller_stop && context.caller_stop->load(std::memory_order_relaxed)) {
+		context.stop->store(true, std::memory_order_relaxed);
+		return true;
+	}
+	if (context.node_limit != 0 && context.nodes >= context.node_limit) {
+		context.stop->store(true, std::memory_order_relaxed);
+		return true;
+	}
+	if ((context.nodes & 1023) != 0) {
 		return false;
 	}
-	if (std::chrono::steady_clock::now() < context.deadline) {
+	context.time->Poll();
+	if (std::chrono::steady_clock::now() < context.time->Deadline()) {
 		return false;
 	}
 	context.stop->store(true, std::memory_order_relaxed);
@@ -94,10 +123,29 @@ bool HasNonPawnMaterial(const Position& position) {
 	return false;
 }
 
+// Make/undo wrappers that keep the evaluation's accumulators in step with the board.
+void MakeSearchMove(Position& position, Move move, MoveState& state, SearchContext& context) {
+	if (context.eval.network) {
+		context.eval.accumulators.Push(position, move);
+	}
+	MakeMove(position, move, state);
+}
+
+void UndoSearchMove(Position& position, Move move, const MoveState& state,
+	SearchContext& context) {
+	UndoMove(position, move, state);
+	if (context.eval.network) {
+		context.eval.accumulators.Pop();
+	}
+}
+
 void MakeNullMove(Position& position, NullState& state) {
 	state.en_passant_square = position.en_passant_square_;
 	state.side_to_move = position.side_to_move_;
+	state.halfmove_clock = position.halfmove_clock_;
 	position.en_passant_square_ = Square::kNoSquare;
+	// Nothing before a null move may count as a repetition after it.
+	position.halfmove_clock_ = 0;
 	position.side_to_move_ = OppositeColor(position.side_to_move_);
 	position.ComputeHash();
 }
@@ -105,6 +153,7 @@ void MakeNullMove(Position& position, NullState& state) {
 void UndoNullMove(Position& position, const NullState& state) {
 	position.en_passant_square_ = state.en_passant_square;
 	position.side_to_move_ = state.side_to_move;
+	position.halfmove_clock_ = state.halfmove_clock;
 	position.ComputeHash();
 }
 
@@ -168,31 +217,66 @@ void UpdateHistory(SearchContext& context, Move move, int depth, int ply) {
 }
 
 int Quiescence(Position& position, int alpha, int beta, SearchContext& context, int ply) {
-	++context.nodes;
 	if (ShouldStop(context)) {
-		return Evaluate(position);
+		return Evaluate(position, context.eval);
+	}
+	++context.nodes;
+	if (position.IsDraw(ply)) {
+		return 0;
 	}
 
-	Square king_square = position.KingSquare(position.side_to_move_);
-	bool in_check = false;
-	if (king_square != Square::kNoSquare) {
-		in_check = IsSquareAttacked(position, king_square,
-			OppositeColor(position.side_to_move_));
+	int alpha_orig = alpha;
+	std::uint64_t key = position.hash_;
+	TranspositionEntry entry;
+	bool tt_hit = context.table.Probe(key, entry, &context.tt_stats);
+	if (tt_hit) {
+		int tt_score = ScoreFromTt(entry.score, ply);
+		if (entry.bound == Bound::kExact ||
+			(entry.bound == Bound::kLower && tt_score >= beta) ||
+			(entry.bound == Bound::kUpper && tt_score <= alpha)) {
+			++context.tt_stats.cutoffs;
+			return tt_score;
+		}
 	}
 
-	int stand_pat = -kInfinity;
+	// The attack maps are only built once the cheap tier could not settle stand-pat.
+	AttackInfo attacks;
+	bool have_attacks = false;
+	Square king_square = position.KingSquare(position.side_to_move_);
+	bool in_check = king_square != Square::kNoSquare &&
+		IsSquareAttacked(position, king_square, OppositeColor(position.side_to_move_));
+
+	int static_eval = kNoStaticEval;
+	int best_score = -kInfinity;
 	if (!in_check) {
-		stand_pat = Evaluate(position);
-		if (stand_pat >= beta) {
-			return stand_pat;
+		// A lazy score is not the real static eval, so it is never cached in the table or in
+		// the evaluation cache.
+		if (tt_hit && entry.static_eval != kNoStaticEval) {
+			static_eval = entry.static_eval;
+			best_score = static_eval;
+		} else if (ProbeEvalCache(position, context.eval, static_eval)) {
+			best_score = static_eval;
+		} else if (!TryLazyEvaluate(position, context.eval, alpha, beta, best_score)) {
+			ComputeAttackInfo(position, attacks);
+			have_attacks = true;
+			static_eval = Evaluate(position, context.eval, attacks);
+			best_score = static_eval;
+		}
+		if (best_score >= beta) {
+			context.table.Store(key, 0, ScoreToTt(best_score, ply), Bound::kLower, kNoMove,
+				static_eval, &context.tt_stats);
+			return best_score;
 		}
-		if (stand_pat > alpha) {
-			alpha = stand_pat;
+		if (best_score > alpha) {
+			alpha = best_score;
 		}
 	}
 
+	if (!have_attacks) {
+		ComputeAttackInfo(position, attacks);
+	}
 	std::vector<Move> moves;
-	GenerateLegalMoves(position, moves);
+	GenerateLegalMoves(position, moves, attacks);
 	if (moves.empty()) {
 		if (in_check) {
 			return -kMateScore + ply;
@@ -204,25 +288,38 @@ int Quiescence(Position& position, int alpha, int beta, SearchContext& context,
 			[](Move move) { return !IsTacticalMove(move); }),
 			moves.end());
 	}
-	if (moves.empty()) {
-		return stand_pat;
-	}
 
-	OrderMoves(moves, kNoMove, &context, ply);
+	OrderMoves(moves, tt_hit ? entry.best_move : kNoMove, &context, ply);
+	Move best_move = kNoMove;
 	for (Move move : moves) {
 		MoveState state;
-		MakeMove(position, move, state);
+		MakeSearchMove(position, move, state, context);
 		int score = -Quiescence(position, -beta, -alpha, context, ply + 1);
-		UndoMove(position, move, state);
+		UndoSearchMove(position, move, state, context);
 
+		if (score > best_score) {
+			best_score = score;
+			best_move = move;
+		}
 		if (score >= beta) {
-			return score;
+			break;
 		}
 		if (score > alpha) {
 			alpha = score;
 		}
 	}
-	return alpha;
+
+	Bound bound;
+	if (best_score <= alpha_orig) {
+		bound = Bound::kUpper;
+	} else if (best_score >= beta) {
+		bound = Bound::kLower;
+	} else {
+		bound = Bound::kExact;
+	}
+	context.table.Store(key, 0, ScoreToTt(best_score, ply), bound, best_move, static_eval,
+		&context.tt_stats);
+	return best_score;
 }
 
 int AlphaBeta(Position& position, int depth, int alpha, int beta, SearchContext& context,
@@ -231,21 +328,27 @@ int AlphaBeta(Position& position, int depth, int alpha, int beta, SearchContext&
 		return Quiescence(position, alpha, beta, context, ply);
 	}
 
-	++context.nodes;
 	if (ShouldStop(context)) {
-		return Evaluate(position);
+		return Evaluate(position, context.eval);
+	}
+	++context.nodes;
+	// Drawn cycles are cut before the table, whose entries do not know the path.
+	if (ply > 0 && position.IsDraw(ply)) {
+		return 0;
 	}
 	int alpha_orig = alpha;
 	int beta_orig = beta;
 	std::uint64_t key = position.hash_;
 	Move tt_move = kNoMove;
 	TranspositionEntry entry;
+	bool tt_hit = context.table.Probe(key, entry, &context.tt_stats);
 
-	if (context.table.Probe(key, entry)) {
+	if (tt_hit) {
 		tt_move = entry.best_move;
 		if (entry.depth >= depth) {
 			int tt_score = ScoreFromTt(entry.score, ply);
 			if (entry.bound == Bound::kExact) {
+				++context.tt_stats.cutoffs;
 				return tt_score;
 			}
 			if (entry.bound == Bound::kLower) {
@@ -254,35 +357,50 @@ int AlphaBeta(Position& position, int depth, int alpha, int beta, SearchContext&
 				beta = std::min(beta, tt_score);
 			}
 			if (alpha >= beta) {
+				++context.tt_stats.cutoffs;
 				return tt_score;
 			}
 		}
 	}
 
+	// Built once and shared by the check test, the evaluation and move generation.
+	AttackInfo attacks;
+	ComputeAttackInfo(position, attacks);
 	Square king_square = position.KingSquare(position.side_to_move_);
-	bool in_check = false;
-	if (king_square != Square::kNoSquare) {
-		in_check = IsSquareAttacked(position, king_square,
-			OppositeColor(position.side_to_move_));
-	}
+	bool in_check = king_square != Square::kNoSquare &&
+		HasBit(attacks.attacked[ToIndex(OppositeColor(position.side_to_move_))], king_square);
+
+	// Interior nodes do not evaluate; they keep an eval a quiescence visit cached here.
+	int static_eval = tt_hit ? entry.static_eval : kNoStaticEval;
 
 	if (!in_check && depth >= 3 && HasNonPawnMaterial(position)) {
 		int reduction = depth >= 6 ? 3 : 2;
 		NullState null_state;
+		if (context.eval.network) {
+			context.eval.accumulators.Push(position, kNoMove);
+		}
 		MakeNullMove(position, null_state);
 		int reduced_depth = std::max(0, depth - 1 - reduction);
 		int score = -AlphaBeta(position, reduced_depth, -beta, -beta + 1, context, ply + 1);
 		UndoNullMove(position, null_state);
+		if (context.eval.network) {
+			context.eval.accumulators.Pop();
+		}
 		if (score >= beta) {
 			return score;
 		}
 	}
 
 	std::vector<Move> moves;
-	GenerateLegalMoves(position, moves);
+	GenerateLegalMoves(position, moves, attacks);
 	if (moves.empty()) {
 		return in_check ? -kMateScore + ply : 0;
 	}
+	// A stored move that is not legal here means another position shares the key.
+	if (tt_move != kNoMove && std::find(moves.begin(), moves.end(), tt_move) == moves.end()) {
+		++context.tt_stats.collisions;
+		tt_move = kNoMove;
+	}
 
 	OrderMoves(moves, tt_move, &context, ply);
 
@@ -291,9 +409,9 @@ int AlphaBeta(Position& position, int depth, int alpha, int beta, SearchContext&
 
 	for (Move move : moves) {
 		MoveState state;
-		MakeMove(position, move, state);
+		MakeSearchMove(position, move, state, context);
 		int score = -AlphaBeta(position, depth - 1, -beta, -alpha, context, ply + 1);
-		UndoMove(position, move, state);
+		UndoSearchMove(position, move, state, context);
 
 		if (score > best_score) {
 			best_score = score;
@@ -316,103 +434,193 @@ int AlphaBeta(Position& position, int depth, int alpha, int beta, SearchContext&
 	} else {
 		bound = Bound::kExact;
 	}
-	context.table.Store(key, depth, ScoreToTt(best_score, ply), bound, best_move);
+	context.table.Store(key, depth, ScoreToTt(best_score, ply), bound, best_move, static_eval,
+		&context.tt_stats);
 	return best_score;
 }
 
-SearchResult SearchRoot(Position& position, int depth, int threads, TranspositionTable& table,
-	std::atomic<bool>* stop, std::chrono::steady_clock::time_point deadline) {
-	SearchResult result;
+// Follows transposition table moves from the position after best_move while they stay
+// legal, stopping at a repeated position or after max_length moves, the depth searched:
+// entries further down are left over from other searches.
+std::vector<Move> ExtractPv(Position& position, Move best_move, TranspositionTable& table,
+	int max_length) {
+	std::vector<Move> pv;
+	if (best_move == kNoMove) {
+		return pv;
+	}
+	std::vector<MoveState> states;
+	std::vector<std::uint64_t> seen = {position.hash_};
+	Move move = best_move;
+	while (move != kNoMove && static_cast<int>(pv.size()) < std::min(max_length, kMaxPly)) {
+		states.emplace_back();
+		MakeMove(position, move, states.back());
+		pv.push_back(move);
+		if (std::find(seen.begin(), seen.end(), position.hash_) != seen.end()) {
+			break;
+		}
+		seen.push_back(position.hash_);
+		move = kNoMove;
+		TranspositionEntry entry;
+		if (table.Probe(position.hash_, entry) && entry.best_move != kNoMove) {
+			std::vector<Move> moves;
+			GenerateLegalMoves(position, moves);
+			if (std::find(moves.begin(), moves.end(), entry.best_move) != moves.end()) {
+				move = entry.best_move;
+			}
+		}
+	}
+	for (std::size_t index = pv.size(); index-- > 0;) {
+		UndoMove(position, pv[index], states[index]);
+	}
+	return pv;
+}
+
+// Root moves persist across iterations and MultiPV lines. Moves before the current line's
+// index belong to earlier lines; the rest are searched in order of last score, then effort.
+struct RootMove {
+	Move move = kNoMove;
+	// Exact only for the best move of a line; moves that fail low keep -kInfinity.
+	int score = -kInfinity;
+	int previous_score = -kInfinity;
+	// Nodes spent below this move in the current iteration.
+	std::uint64_t nodes = 0;
+	std::vector<Move> pv;
+};
+
+// Highest score first. Moves that failed low tie at -kInfinity and are ranked by the nodes
+// it took to refute them, since a move that was hard to refute is the likelier to improve.
+void SortRootMoves(std::vector<RootMove>::iterator first, std::vector<RootMove>::iterator last) {
+	std::stable_sort(first, last, [](const RootMove& left, const RootMove& right) {
+		return left.score != right.score ? left.score > right.score : left.nodes > right.nodes;
+	});
+}
+
+std::vector<RootMove> MakeRootMoves(Position& position, const SearchLimits& limits,
+	TranspositionTable& table) {
 	std::vector<Move> moves;
 	GenerateLegalMoves(position, moves);
+	if (!limits.search_moves.empty()) {
+		std::erase_if(moves, [&limits](Move move) {
+			return std::find(limits.search_moves.begin(), limits.search_moves.end(), move) ==
+				limits.search_moves.end();
+		});
+	}
+	TranspositionEntry entry;
+	OrderMoves(moves, table.Probe(position.hash_, entry) ? entry.best_move : kNoMove, nullptr,
+		0);
+	std::vector<RootMove> root_moves(moves.size());
+	for (std::size_t index = 0; index < moves.size(); ++index) {
+		root_moves[index].move = moves[index];
+	}
+	return root_moves;
+}
 
-	if (moves.empty()) {
-		Square king_square = position.KingSquare(position.side_to_move_);
-		bool in_check = IsSquareAttacked(position, king_square,
-			OppositeColor(position.side_to_move_));
-		result.score = in_check ? -kMateScore : 0;
-		result.depth = depth;
+// Searches root_moves from first on with one context per thread and sorts that range, leaving
+// the line's best move at first. Moves that were not finished before a stop keep their place.
+SearchResult SearchRoot(Position& position, int depth, std::vector<SearchContext>& contexts,
+	std::vector<RootMove>& root_moves, std::size_t first, int window_alpha, int window_beta,
+	std::uint64_t thread_node_limit) {
+	SearchResult result;
+	result.depth = depth;
+	if (first >= root_moves.size()) {
 		return result;
 	}
+	for (std::size_t index = first; index < root_moves.size(); ++index) {
+		root_moves[index].score = -kInfinity;
+		root_moves[index].nodes = 0;
+	}
 
-	TranspositionEntry entry;
-	if (table.Probe(position.hash_, entry)) {
-		OrderMoves(moves, entry.best_move, nullptr, 0);
-	} else {
-		OrderMoves(moves, kNoMove, nullptr, 0);
+	for (SearchContext& context : contexts) {
+		context.nodes = 0;
+		context.tt_stats = {};
+		context.node_limit = thread_node_limit;
+		context.eval.accumulators.Reset();
 	}
+	std::atomic<bool>* stop = contexts.front().stop;
+	int threads = static_cast<int>(contexts.size());
 
 	int best_score = -kInfinity;
 	Move best_move = kNoMove;
 	std::uint64_t total_nodes = 0;
+	TranspositionStats tt_stats;
 
-	if (threads <= 1 || moves.size() < 2) {
-		SearchContext context{table};
-		context.stop = stop;
-		context.deadline = deadline;
-		int alpha = -kInfinity;
-		int beta = kInfinity;
-		for (Move move : moves) {
-			if (stop && stop->load(std::memory_order_relaxed)) {
+	if (threads <= 1 || root_moves.size() - first < 2) {
+		SearchContext& context = contexts.front();
+		int alpha = window_alpha;
+		int beta = window_beta;
+		for (std::size_t index = first; index < root_moves.size(); ++index) {
+			// Also catches a budget spent by the moves before, which would otherwise cost a
+			// node for every move left.
+			if (ShouldStop(context)) {
 				break;
 			}
+			RootMove& root_move = root_moves[index];
+			std::uint64_t nodes_before = context.nodes;
 			MoveState state;
-			MakeMove(position, move, state);
+			MakeSearchMove(position, root_move.move, state, context);
 			int score = -AlphaBeta(position, depth - 1, -beta, -alpha, context, 1);
-			UndoMove(position, move, state);
-			if (stop && stop->load(std::memory_order_relaxed)) {
+			UndoSearchMove(position, root_move.move, state, context);
+			if (stop->load(std::memory_order_relaxed)) {
 				break;
 			}
+			root_move.nodes = context.nodes - nodes_before;
 
 			if (score > best_score) {
 				best_score = score;
-				best_move = move;
+				best_move = root_move.move;
+			}
+			if (score > alpha) {
+				root_move.score = score;
+				alpha = score;
 			}
-			alpha = std::max(alpha, score);
 			if (alpha >= beta) {
 				break;
 			}
 		}
 		total_nodes = context.nodes;
+		tt_stats = context.tt_stats;
 	} else {
-		std::atomic<std::size_t> next_index{0};
+		std::atomic<std::size_t> next_index{first};
 		std::mutex best_mutex;
-		std::vector<std::uint64_t> nodes_per_thread(static_cast<std::size_t>(threads), 0);
 		std::vector<std::thread> workers;
 		workers.reserve(static_cast<std::size_t>(threads));
 
 		for (int thread_index = 0; thread_index < threads; ++thread_index) {
 			workers.emplace_back([&, thread_index]() {
-				SearchContext context{table};
-				context.stop = stop;
-				context.deadline = deadline;
+				SearchContext& context = contexts[static_cast<std::size_t>(thread_index)];
 				Position local = position;
 				while (true) {
-					if (stop && stop->load(std::memory_order_relaxed)) {
+					if (ShouldStop(context)) {
 						break;
 					}
 					std::size_t index = next_index.fetch_add(1);
-					if (index >= moves.size()) {
+					if (index >= root_moves.size()) {
 						break;
 					}
-					Move move = moves[index];
+					// Each index is claimed by one thread, so its entry needs no lock.
+					RootMove& root_move = root_moves[index];
+					std::uint64_t nodes_before = context.nodes;
 					MoveState state;
-					MakeMove(local, move, state);
-					int score = -AlphaBeta(local, depth - 1, -kInfinity, kInfinity, context, 1);
-					UndoMove(local, move, state);
-					if (stop && stop->load(std::memory_order_relaxed)) {
+					MakeSearchMove(local, root_move.move, state, context);
+					int score = -AlphaBeta(local, depth - 1, -window_beta, -window_alpha, context,
+						1);
+					UndoSearchMove(local, root_move.move, state, context);
+					if (stop->load(std::memory_order_relaxed)) {
 						break;
 					}
+					root_move.nodes = context.nodes - nodes_before;
+					if (score > window_alpha) {
+						root_move.score = score;
+					}
 
 					{
 						std::lock_guard<std::mutex> guard(best_mutex);
 						if (score > best_score) {
 							best_score = score;
-							best_move = move;
+							best_move = root_move.move;
 						}
 					}
 				}
-				nodes_per_thread[static_cast<std::size_t>(thread_index)] = context.nodes;
 			});
 		}
 
@@ -420,19 +628,225 @@ SearchResult SearchRoot(Position& position, int depth, int threads, Transpositio
 			worker.join();
 		}
 
-		for (std::uint64_t nodes : nodes_per_thread) {
-			total_nodes += nodes;
+		for (const SearchContext& context : contexts) {
+			total_nodes += context.nodes;
+			tt_stats += context.tt_stats;
 		}
 	}
 
+	if (!stop->load(std::memory_order_relaxed)) {
+		SortRootMoves(root_moves.begin() + static_cast<std::ptrdiff_t>(first), root_moves.end());
+	}
 	result.best_move = best_move;
 	result.score = best_score;
-	result.depth = depth;
 	result.nodes = total_nodes;
-	table.Store(position.hash_, depth, ScoreToTt(best_score, 0), Bound::kExact, best_move);
+	result.tt_stats = tt_stats;
+	// Only the first line's move and score describe the root.
+	if (first == 0) {
+		contexts.front().table.Store(position.hash_, depth, ScoreToTt(best_score, 0), Bound::kExact, best_move,
+			kNoStaticEval);
+	}
 	return result;
 }
 
+struct MateSearch {
+	SearchContext& context;
+	// Position keys mixed with the moves left where no mate was found, each in the slot its
+	// low bits pick; zero is empty.
+	std::vector<std::uint64_t> refuted = std::vector<std::uint64_t>(kRefutedSlots, 0);
+};
+
+std::uint64_t MateKey(const Position& position, int moves) {
+	return position.hash_ ^ (static_cast<std::uint64_t>(moves) * 0x9E3779B97F4A7C15ULL);
+}
+
+// Direct and discovered checks read off the board. En passant and castling, which move a
+// second piece, are rare enough to be made and taken back instead.
+bool GivesCheck(Position& position, Move move) {
+	MoveFlag flag = MoveFlagOf(move);
+	if (flag == MoveFlag::kEnPassant || flag == MoveFlag::kCastle) {
+		MoveState state;
+		MakeMove(position, move, state);
+		Square king_square = position.KingSquare(position.side_to_move_);
+		bool check = king_square != Square::kNoSquare &&
+			IsSquareAttacked(position, king_square, OppositeColor(position.side_to_move_));
+		UndoMove(position, move, state);
+		return check;
+	}
+	Color us = position.side_to_move_;
+	Square king_square = position.KingSquare(OppositeColor(us));
+	if (king_square == Square::kNoSquare) {
+		return false;
+	}
+	Square from = FromSquare(move);
+	Square to = ToSquare(move);
+	Bitboard occupancy = (position.all_occupancy_bb_ & ~SquareBit(from)) | SquareBit(to);
+	PieceType type = flag == MoveFlag::kPromotion ? PromotionPiece(move)
+		: PieceTypeFromPiece(position.board_[ToIndex(from)]);
+	Bitboard attacks = 0;
+	if (type == PieceType::kPawn) {
+		attacks = PawnAttacks(us, to);
+	} else if (type == PieceType::kKnight) {
+		attacks = KnightAttacks(to);
+	} else if (type == PieceType::kBishop) {
+		attacks = BishopAttacks(to, occupancy);
+	} else if (type == PieceType::kRook) {
+		attacks = RookAttacks(to, occupancy);
+	} else if (type == PieceType::kQueen) {
+		attacks = QueenAttacks(to, occupancy);
+	}
+	if (HasBit(attacks, king_square)) {
+		return true;
+	}
+	// A slider of ours that the moved piece no longer blocks.
+	const auto& ours = position.piece_bb_[ToIndex(us)];
+	Bitboard queens = ours[ToIndex(PieceType::kQueen)];
+	Bitboard sliders =
+		(BishopAttacks(king_square, occupancy) & (ours[ToIndex(PieceType::kBishop)] | queens)) |
+		(RookAttacks(king_square, occupancy) & (ours[ToIndex(PieceType::kRook)] | queens));
+	return (sliders & ~SquareBit(from)) != 0;
+}
+
+// Checks first, then the usual capture and promotion order. With one move left only a check
+// can mate, so everything else is dropped; earlier, EveryReplyMated prunes quiet moves.
+void OrderMateMoves(Position& position, std::vector<Move>& moves, bool checks_only) {
+	OrderMoves(moves, kNoMove, nullptr, 0);
+	auto quiet = std::stable_partition(moves.begin(), moves.end(),
+		[&position](Move move) { return GivesCheck(position, move); });
+	if (checks_only) {
+		moves.erase(quiet, moves.end());
+	}
+}
+
+bool EveryReplyMated(Position& position, int moves, MateSearch& search, std::vector<Move>& pv);
+
+// True if the side to move mates in at most `moves` moves. Exact: every defence is tried, and
+// pv receives the attacking line.
+bool ProveMate(Position& position, int moves, MateSearch& search, std::vector<Move>& pv) {
+	if (ShouldStop(search.context)) {
+		return false;
+	}
+	++search.context.nodes;
+	std::uint64_t key = MateKey(position, moves);
+	std::uint64_t& refuted = search.refuted[key & (kRefutedSlots - 1)];
+	if (refuted == key) {
+		return false;
+	}
+	std::vector<Move> candidates;
+	GenerateLegalMoves(position, candidates);
+	OrderMateMoves(position, candidates, moves == 1);
+	for (Move move : candidates) {
+		MoveState state;
+		MakeMove(position, move, state);
+		std::vector<Move> line;
+		bool mated = EveryReplyMated(position, moves, search, line);
+		UndoMove(position, move, state);
+		if (mated) {
+			pv.clear();
+			pv.push_back(move);
+			pv.insert(pv.end(), line.begin(), line.end());
+			return true;
+		}
+	}
+	if (!search.context.stop->load(std::memory_order_relaxed)) {
+		refuted = key;
+	}
+	return false;
+}
+
+// True if the side to move is mated now or within `moves` - 1 further attacking moves whatever
+// it plays. pv receives the longest of the forced lines. The attacking move just played counts
+// only if it gives check or leaves at most kMateQuietReplies replies, so a quiet mate behind
+// a freer move is missed.
+bool EveryReplyMated(Position& position, int moves, MateSearch& search, std::vector<Move>& pv) {
+	if (ShouldStop(search.context)) {
+		return false;
+	}
+	++search.context.nodes;
+	std::vector<Move> replies;
+	GenerateLegalMoves(position, replies);
+	Square king_square = position.KingSquare(position.side_to_move_);
+	bool in_check = king_square != Square::kNoSquare &&
+		IsSquareAttacked(position, king_square, OppositeColor(position.side_to_move_));
+	if (replies.empty()) {
+		return in_check;
+	}
+	if (moves == 1 || (!in_check && replies.size() > kMateQuietReplies)) {
+		return false;
+	}
+	// Captures first: they refute most attempts soonest.
+	OrderMoves(replies, kNoMove, nullptr, 0);
+	pv.clear();
+	for (Move reply : replies) {
+		MoveState state;
+		MakeMove(position, reply, state);
+		std::vector<Move> line;
+		bool mated = ProveMate(position, moves - 1, search, line);
+		UndoMove(position, reply, state);
+		if (!mated) {
+			return false;
+		}
+		if (pv.empty() || line.size() + 1 > pv.size()) {
+			pv.clear();
+			pv.push_back(reply);
+			pv.insert(pv.end(), line.begin(), line.end());
+		}
+	}
+	return true;
+}
+
+// Tries mates in 1 to max_moves moves over the root moves, shortest first, and fills result
+// with the first one proven. False if there is none in range or the search was stopped.
+bool SearchMate(Position& position, int max_moves, const std::vector<RootMove>& root_moves,
+	SearchContext& context, SearchResult& result) {
+	MateSearch search{context};
+	std::vector<Move> candidates;
+	for (const RootMove& root_move : root_moves) {
+		candidates.push_back(root_move.move);
+	}
+	for (int moves = 1; moves <= max_moves; ++moves) {
+		std::vector<Move> ordered = candidates;
+		OrderMateMoves(position, ordered, moves == 1);
+		for (Move move : ordered) {
+			MoveState state;
+			MakeMove(position, move, state);
+			std::vector<Move> line;
+			bool mated = EveryReplyMated(position, moves, search, line);
+			UndoMove(position, move, state);
+			if (context.stop->load(std::memory_order_relaxed)) {
+				result.nodes = context.nodes;
+				return false;
+			}
+			if (mated) {
+				result.best_move = move;
+				result.depth = 2 * moves - 1;
+				result.score = kMateScore - result.depth;
+				result.nodes = context.nodes;
+				std::vector<Move> pv = {move};
+				pv.insert(pv.end(), line.begin(), line.end());
+				result.lines.push_back({result.score, std::move(pv)});
+				return true;
+			}
+		}
+	}
+	result.nodes = context.nodes;
+	return false;
+}
+
+}
+
+int MateInMoves(int score) {
+	if (score > kMateThreshold) {
+		return (kMateScore - score + 1) / 2;
+	}
+	if (score < -kMateThreshold) {
+		return -(kMateScore + score) / 2;
+	}
+	return 0;
+}
+
+bool IsSearchScore(int score) {
+	return score > -kInfinity && score < kInfinity;
 }
 
 SearchResult Search(Position& position, int max_depth, TranspositionTable& table, int threads) {
@@ -446,33 +860,212 @@ SearchResult Search(Position& position, const SearchLimits& limits, Transpositio
 	SearchResult result;
 	SearchResult best;
 	bool have_best = false;
-	std::atomic<bool> local_stop{false};
-	auto* stop_ptr = limits.stop;
-	if (!stop_ptr && limits.time_ms > 0) {
-		stop_ptr = &local_stop;
-	}
-	auto deadline = limits.time_ms > 0
-		? std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.time_ms)
-		: std::chrono::steady_clock::time_point::max();
+	TranspositionStats tt_stats;
+	// Evaluation caches persist across iterations, one per worker thread, and across searches
+	// when the caller owns them.
+	std::vector<EvalContext> local_contexts;
+	std::vector<EvalContext>& eval_contexts =
+		limits.eval_contexts ? *limits.eval_contexts : local_contexts;
+	eval_contexts.resize(static_cast<std::size_t>(std::max(1, threads)));
+	std::uint64_t evaluator = limits.network ? limits.network->Fingerprint() : 0;
+	for (auto& eval_context : eval_contexts) {
+		if (eval_context.evaluator != evaluator) {
+			eval_context.eval_cache.Clear();
+			eval_context.evaluator = evaluator;
+		}
+		eval_context.network = limits.network;
+		eval_context.stats = {};
+	}
+	table.NewSearch();
+	table.SetEvaluator(evaluator);
+	// Raised by the clock, the node budget or a copy of the caller's stop; the caller's own
+	// flag is only ever read.
+	std::atomic<bool> search_stop{false};
+	int thread_count = std::max(1, threads);
+	// Nodes spent so far against a go nodes budget, aborted searches included.
+	std::uint64_t nodes_used = 0;
+	TimeManager time_manager(limits.optimum_ms, limits.time_ms, limits.pondering);
 	int max_depth = limits.max_depth > 0 ? limits.max_depth : kMaxPly;
 	if (limits.infinite) {
 		max_depth = std::numeric_limits<int>::max();
 	}
-	for (int depth = 1; depth <= max_depth; ++depth) {
-		if (limits.time_ms > 0 && std::chrono::steady_clock::now() >= deadline) {
+	std::vector<RootMove> root_moves = MakeRootMoves(position, limits, table);
+	if (root_moves.empty()) {
+		Square king_square = position.KingSquare(position.side_to_move_);
+		bool in_check = king_square != Square::kNoSquare &&
+			IsSquareAttacked(position, king_square, OppositeColor(position.side_to_move_));
+		result.score = in_check ? -kMateScore : 0;
+		result.depth = 1;
+		max_depth = 0;
+	}
+	// go mate tries an exact mate search first and falls back to the normal search, to the
+	// depth of the longest mate asked for unless some other limit is given.
+	// Running out of the mate search's share of the budget ends only the mate search.
+	if (limits.mate > 0 && !root_moves.empty()) {
+		std::uint64_t mate_nodes = limits.nodes == 0 ? 0
+			: std::max<std::uint64_t>(1, limits.nodes - limits.nodes / kMateFallbackShare);
+		// Under a clock the share comes from the soft target, which the fallback keeps to.
+		std::int64_t mate_budget_ms = limits.optimum_ms > 0 ? limits.optimum_ms : limits.time_ms;
+		TimeManager mate_time(0, mate_budget_ms - mate_budget_ms / kMateFallbackShare,
+			limits.pondering);
+		std::atomic<bool> mate_stop{false};
+		SearchContext context{table, eval_contexts.front()};
+		context.stop = &mate_stop;
+		context.caller_stop = limits.stop;
+		context.time = &mate_time;
+		context.node_limit = mate_nodes;
+		SearchResult mate_result;
+		bool mated = false;
+		if (limits.mate_solver) {
+			MateSolverLimits solver_limits;
+			solver_limits.threads = threads;
+			solver_limits.nodes = mate_nodes;
+			solver_limits.stop = limits.stop;
+			solver_limits.time = &mate_time;
+			for (const RootMove& root_move : root_moves) {
+				solver_limits.root_moves.push_back(root_move.move);
+			}
+			MateSolution solution = limits.mate_solver->Solve(position, limits.mate, solver_limits);
+			mate_result.nodes = solution.nodes;
+			if (solution.found) {
+				mated = true;
+				mate_result.best_move = solution.pv.front();
+				mate_result.depth = 2 * solution.moves - 1;
+				mate_result.score = kMateScore - mate_result.depth;
+				mate_result.lines.push_back({mate_result.score, solution.pv});
+			}
+		} else {
+			mated = SearchMate(position, limits.mate, root_moves, context, mate_result);
+		}
+		if (mated) {
+			best = mate_result;
+			have_best = true;
+			max_depth = 0;
+			if (limits.on_iteration) {
+				limits.on_iteration(best);
+			}
+		} else if (limits.max_depth == 0 && !limits.infinite && limits.time_ms == 0 &&
+			limits.nodes == 0) {
+			max_depth = 2 * limits.mate - 1;
+		}
+		nodes_used += mate_result.nodes;
+		time_manager.StartIterations();
+	}
+	std::size_t line_count =
+		std::min(static_cast<std::size_t>(std::max(1, limits.multipv)), root_moves.size());
+	// Killers and history carry over from one line and iteration to the next.
+	std::vector<SearchContext> contexts;
+	contexts.reserve(eval_contexts.size());
+	for (EvalContext& eval_context : eval_contexts) {
+		contexts.push_back(SearchContext{table, eval_context});
+		contexts.back().stop = &search_stop;
+		contexts.back().time = &time_manager;
+	}
+	bool stopped = false;
+	// Nodes of the first line, against which the best move's share of the effort is taken.
+	std::uint64_t best_line_nodes = 0;
+	for (int depth = 1; depth <= max_depth && !stopped; ++depth) {
+		if (have_best && !time_manager.ShouldStartIteration()) {
 			break;
 		}
-		result = SearchRoot(position, depth, threads, table, stop_ptr, deadline);
-		if (stop_ptr && stop_ptr->load(std::memory_order_relaxed)) {
-			if (!have_best) {
-				best = result;
+		// The caller's stop is ignored until an iteration has finished, so a stop sent right
+		// after go still gets a searched move. The clock and a node budget apply from the start.
+		for (SearchContext& context : contexts) {
+			context.caller_stop = have_best ? limits.stop : nullptr;
+		}
+		for (RootMove& root_move : root_moves) {
+			root_move.previous_score = root_move.score;
+		}
+		// Each MultiPV line is a root search over the moves earlier lines did not take, with
+		// its own window; the table carries over from the lines before it.
+		for (std::size_t line = 0; line < line_count; ++line) {
+			int alpha = -kInfinity;
+			int beta = kInfinity;
+			int previous_score = root_moves[line].previous_score;
+			if (line > 0 && depth >= kAspirationDepth && previous_score != -kInfinity) {
+				alpha = previous_score - kAspirationMargin;
+				beta = previous_score + kAspirationMargin;
+			}
+			SearchResult line_result;
+			std::uint64_t line_nodes = 0;
+			while (true) {
+				// Each thread gets an equal share of what is left, so the threads together
+				// never pass the budget.
+				std::uint64_t thread_node_limit = 0;
+				if (limits.nodes > 0) {
+					thread_node_limit = nodes_used >= limits.nodes ? 0
+						: (limits.nodes - nodes_used) / thread_count;
+					if (thread_node_limit == 0) {
+						search_stop.store(true, std::memory_order_relaxed);
+						break;
+					}
+				}
+				line_result = SearchRoot(position, depth, contexts, root_moves, line, alpha,
+					beta, thread_node_limit);
+				tt_stats += line_result.tt_stats;
+				nodes_used += line_result.nodes;
+				line_nodes += line_result.nodes;
+				bool failed = line_result.score <= alpha || line_result.score >= beta;
+				if (!failed || search_stop.load(std::memory_order_relaxed)) {
+					break;
+				}
+				alpha = -kInfinity;
+				beta = kInfinity;
 			}
+			line_result.nodes = line_nodes;
+			if (search_stop.load(std::memory_order_relaxed)) {
+				stopped = true;
+				// A first iteration cut short keeps the best of the moves it finished.
+				if (!have_best && line == 0) {
+					result = line_result;
+				}
+				break;
+			}
+			if (line == 0) {
+				result = line_result;
+				best_line_nodes = line_nodes;
+			}
+			if (line_result.best_move == kNoMove) {
+				break;
+			}
+			root_moves[line].pv = ExtractPv(position, line_result.best_move, table,
+				depth);
+			result.lines.push_back({line_result.score, root_moves[line].pv});
+		}
+		if (stopped) {
 			break;
 		}
+		// Reported as the whole search's nodes so far, re-searches and the mate search
+		// included.
+		result.nodes = nodes_used;
 		best = result;
 		have_best = true;
+		time_manager.CompleteIteration(result.best_move, result.score,
+			best_line_nodes == 0 ? 0
+				: static_cast<int>(root_moves.front().nodes * 1000 / best_line_nodes));
+		if (limits.on_iteration) {
+			limits.on_iteration(result);
+		}
+	}
+	// Without any finished move the first move in order is played, with no score to report.
+	if (!have_best && result.best_move == kNoMove && !root_moves.empty()) {
+		result.best_move = root_moves.front().move;
+		result.score = -kInfinity;
+		result.depth = 0;
+	}
+	SearchResult& final_result = have_best ? best : result;
+	final_result.nodes = nodes_used;
+	final_result.tt_stats = tt_stats;
+	for (const auto& eval_context : eval_contexts) {
+		final_result.eval_stats += eval_context.stats;
+	}
+	final_result.hashfull = table.Hashfull();
+	if (!final_result.lines.empty() && final_result.lines.front().pv.size() > 1) {
+		final_result.ponder_move = final_result.lines.front().pv[1];
 	}
-	return have_best ? best : result;
+	final_result.time_stats =
+		time_manager.Finish(stopped && std::chrono::steady_clock::now() >= time_manager.Deadline());
+	return final_result;
 }
 
 }
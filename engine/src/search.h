@@ -2,27 +2,73 @@
 
 #include <atomic>
 #include <cstdint>
+#include <functional>
+#include <vector>
 
+#include "eval.h"
+#include "mate_solver.h"
 #include "move.h"
+#include "nnue.h"
 #include "position.h"
+#include "time_manager.h"
 #include "transposition_table.h"
 
 namespace flare {
 
+struct PvLine {
+	int score = 0;
+	std::vector<Move> pv;
+};
+
 struct SearchResult {
 	Move best_move = kNoMove;
+	// The expected reply, the second move of the first line.
+	Move ponder_move = kNoMove;
 	int score = 0;
 	int depth = 0;
 	std::uint64_t nodes = 0;
+	int hashfull = 0;
+	TranspositionStats tt_stats;
+	EvalStats eval_stats;
+	TimeStats time_stats;
+	// Best line first; one per MultiPV line, each following its move through the table.
+	std::vector<PvLine> lines;
 };
 
 struct SearchLimits {
 	int max_depth = 0;
+	// Hard ceiling; the search aborts mid-iteration once it passes.
 	std::int64_t time_ms = 0;
+	// Soft target scaled by best-move stability and score drops; zero keeps only time_ms.
+	std::int64_t optimum_ms = 0;
 	bool infinite = false;
 	std::atomic<bool>* stop = nullptr;
+	// The clock starts only once this is cleared, as on ponderhit.
+	const std::atomic<bool>* pondering = nullptr;
+	// Evaluates with this network instead of the classical evaluation when set.
+	const nnue::Network* network = nullptr;
+	// Number of best root moves to search with exact scores.
+	int multipv = 1;
+	// Node budget for the whole search, split evenly between threads; zero for none.
+	std::uint64_t nodes = 0;
+	// Looks for a mate in at most this many moves first, as for go mate; zero for none.
+	int mate = 0;
+	// Proves go mate with this proof-number solver instead of the alpha-beta prover when set.
+	MateSolver* mate_solver = nullptr;
+	// Per-thread evaluation caches kept from one search to the next when set; resized to the
+	// thread count and emptied when the evaluator changes.
+	std::vector<EvalContext>* eval_contexts = nullptr;
+	// Restricts the root to these moves when not empty, as for go searchmoves.
+	std::vector<Move> search_moves;
+	// Called on the thread running Search after every completed iteration.
+	std::function<void(const SearchResult&)> on_iteration;
 };
 
+// Moves to mate for a mate score, negative when being mated; zero for any other score.
+int MateInMoves(int score);
+// False for the bound a root search leaves when it finished no move.
+bool IsSearchScore(int score);
+
 SearchResult Search(Position& position, int max_depth, TranspositionTable& table, int threads = 1);
 SearchResult Search(Position& position, const SearchLimits& limits, TranspositionTable& table,
 	int threads = 1);
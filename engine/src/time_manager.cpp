@@ -0,0 +1,167 @@
+#include "time_manager.h"
+
+#include <algorithm>
+#include <array>
+
+namespace flare {
+namespace {
+
+constexpr int kDefaultMovesToGo = 30;
+// Kept back from every move for GUI and pipe latency.
+constexpr std::int64_t kMoveOverheadMs = 10;
+constexpr std::int64_t kMaximumRatio = 4;
+// Bounds, in permille, on how much longer the next iteration is assumed to take than the last
+// one; within them the measured ratio of the last two iterations is used.
+constexpr std::int64_t kMinIterationGrowthPermille = 2000;
+constexpr std::int64_t kMaxIterationGrowthPermille = 10000;
+// Soft limit scale in permille by how many iterations in a row kept the best move.
+constexpr std::array<std::int64_t, 5> kStabilityPermille = {1000, 1000, 850, 700, 550};
+constexpr std::int64_t kChangedPermille = 1500;
+// Every centipawn lost since the last iteration adds this much, up to kMaxDropPermille.
+constexpr std::int64_t kDropPermillePerCp = 5;
+constexpr std::int64_t kMaxDropPermille = 1000;
+// A best move that took this share of the nodes leaves the soft limit unscaled; every
+// permille above or below it moves the limit the other way, within the effort bounds.
+constexpr std::int64_t kEffortPivotPermille = 600;
+constexpr std::int64_t kMinEffortPermille = 700;
+constexpr std::int64_t kMaxEffortPermille = 1200;
+
+}
+
+TimeBudget AllocateTime(std::int64_t remaining_ms, std::int64_t increment_ms, int moves_to_go) {
+	TimeBudget budget;
+	if (remaining_ms <= 0) {
+		return budget;
+	}
+	int moves = moves_to_go > 0 ? moves_to_go : kDefaultMovesToGo;
+	std::int64_t usable = std::max<std::int64_t>(1, remaining_ms - kMoveOverheadMs);
+	std::int64_t optimum = (remaining_ms / moves + increment_ms) * 9 / 10;
+	budget.optimum_ms = std::clamp<std::int64_t>(optimum, 1, usable);
+	std::int64_t maximum = std::min(budget.optimum_ms * kMaximumRatio, remaining_ms / 3);
+	budget.maximum_ms = std::min(usable, std::max(budget.optimum_ms, maximum));
+	return budget;
+}
+
+TimeManager::TimeManager(std::int64_t optimum_ms, std::int64_t maximum_ms,
+	const std::atomic<bool>* pondering)
+	: pondering_(pondering),
+	  deadline_ticks_(std::chrono::steady_clock::time_point::max().time_since_epoch().count()),
+	  last_completion_(std::chrono::steady_clock::now()),
+	  optimum_ms_(maximum_ms > 0 ? std::min(optimum_ms, maximum_ms) : 0),
+	  maximum_ms_(std::max<std::int64_t>(0, maximum_ms)) {
+	Poll();
+}
+
+void TimeManager::Poll() {
+	if (started_.load(std::memory_order_acquire) ||
+		(pondering_ && pondering_->load(std::memory_order_relaxed))) {
+		return;
+	}
+	bool expected = false;
+	if (!started_.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	start_ticks_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+	if (maximum_ms_ > 0) {
+		auto deadline = now + std::chrono::milliseconds(maximum_ms_);
+		deadline_ticks_.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+	}
+}
+
+bool TimeManager::Pondering() const {
+	return !started_.load(std::memory_order_acquire);
+}
+
+bool TimeManager::HasClock() const {
+	return maximum_ms_ > 0;
+}
+
+std::chrono::steady_clock::time_point TimeManager::Deadline() const {
+	return std::chrono::steady_clock::time_point(
+		std::chrono::steady_clock::duration(deadline_ticks_.load(std::memory_order_relaxed)));
+}
+
+std::chrono::steady_clock::time_point TimeManager::Start() const {
+	return std::chrono::steady_clock::time_point(
+		std::chrono::steady_clock::duration(start_ticks_.load(std::memory_order_relaxed)));
+}
+
+std::int64_t TimeManager::ElapsedMs() const {
+	if (Pondering()) {
+		return 0;
+	}
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - Start()).count();
+}
+
+void TimeManager::StartIterations() {
+	last_completion_ = std::chrono::steady_clock::now();
+}
+
+void TimeManager::CompleteIteration(Move best_move, int score, int best_move_permille) {
+	auto now = std::chrono::steady_clock::now();
+	previous_iteration_ = last_iteration_;
+	last_iteration_ = now - last_completion_;
+	last_completion_ = now;
+	best_move_changed_ = iterations_ > 0 && best_move != best_move_;
+	stable_iterations_ = iterations_ > 0 && !best_move_changed_ ? stable_iterations_ + 1 : 0;
+	score_drop_ = iterations_ > 0 ? std::max(0, score_ - score) : 0;
+	best_move_ = best_move;
+	score_ = score;
+	best_move_permille_ = best_move_permille;
+	++iterations_;
+}
+
+std::int64_t TimeManager::SoftLimitMs() const {
+	if (optimum_ms_ == 0) {
+		return maximum_ms_;
+	}
+	std::int64_t stability = best_move_changed_ ? kChangedPermille
+		: kStabilityPermille[std::min<std::size_t>(stable_iterations_,
+			kStabilityPermille.size() - 1)];
+	std::int64_t drop = 1000 + std::min(score_drop_ * kDropPermillePerCp, kMaxDropPermille);
+	std::int64_t effort = best_move_permille_ == 0 ? 1000
+		: std::clamp<std::int64_t>(1000 + kEffortPivotPermille - best_move_permille_,
+			kMinEffortPermille, kMaxEffortPermille);
+	std::int64_t soft = optimum_ms_ * stability / 1000 * drop / 1000 * effort / 1000;
+	return std::min(soft, maximum_ms_);
+}
+
+bool TimeManager::ShouldStartIteration() {
+	Poll();
+	if (Pondering() || !HasClock()) {
+		return true;
+	}
+	if (ElapsedMs() >= SoftLimitMs()) {
+		return false;
+	}
+	// Clock ticks rather than milliseconds, which round the short early iterations to zero.
+	std::int64_t growth_permille = previous_iteration_.count() > 0
+		? std::clamp<std::int64_t>(last_iteration_.count() * 1000 / previous_iteration_.count(),
+			kMinIterationGrowthPermille, kMaxIterationGrowthPermille)
+		: kMinIterationGrowthPermille;
+	auto predicted = last_iteration_ * growth_permille / 1000;
+	return predicted < Deadline() - std::chrono::steady_clock::now();
+}
+
+TimeStats TimeManager::Finish(bool hard_stopped) const {
+	auto now = std::chrono::steady_clock::now();
+	TimeStats stats;
+	stats.optimum_ms = optimum_ms_;
+	stats.maximum_ms = maximum_ms_;
+	stats.soft_limit_ms = SoftLimitMs();
+	stats.elapsed_ms = ElapsedMs();
+	stats.iterations = iterations_;
+	if (HasClock() && !Pondering()) {
+		stats.overshoot_ms = std::max<std::int64_t>(0, stats.elapsed_ms - maximum_ms_);
+		if (hard_stopped && now > Deadline()) {
+			stats.stop_latency_us =
+				std::chrono::duration_cast<std::chrono::microseconds>(now - Deadline()).count();
+		}
+	}
+	return stats;
+}
+
+}
+
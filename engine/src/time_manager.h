@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "move.h"
+
+namespace flare {
+
+// Soft target and hard ceiling for one move, in milliseconds.
+struct TimeBudget {
+	std::int64_t optimum_ms = 0;
+	std::int64_t maximum_ms = 0;
+};
+
+// Splits the remaining clock over the moves to go, assuming 30 when the GUI sends none.
+// Returns an empty budget when there is no time left.
+TimeBudget AllocateTime(std::int64_t remaining_ms, std::int64_t increment_ms, int moves_to_go);
+
+struct TimeStats {
+	std::int64_t optimum_ms = 0;
+	std::int64_t maximum_ms = 0;
+	std::int64_t soft_limit_ms = 0;
+	std::int64_t elapsed_ms = 0;
+	// Time spent past the hard ceiling.
+	std::int64_t overshoot_ms = 0;
+	// Time from the hard deadline passing to the search returning, when it stopped on it.
+	std::int64_t stop_latency_us = 0;
+	int iterations = 0;
+};
+
+// Decides between iterations whether another one is worth starting. The soft limit shrinks
+// while the best move stays put or takes most of the iteration's nodes, and grows when it
+// changes, the score drops or the nodes spread over several moves; the hard deadline is what
+// the search itself polls.
+class TimeManager {
+public:
+	// A zero maximum means no clock. A zero optimum keeps only the hard limit, as for
+	// movetime, where stopping early on a stable move would waste the time given. While
+	// *pondering is set the clock has not started: there is no deadline and every iteration
+	// is started.
+	TimeManager(std::int64_t optimum_ms, std::int64_t maximum_ms,
+		const std::atomic<bool>* pondering = nullptr);
+
+	TimeManager(const TimeManager&) = delete;
+	TimeManager& operator=(const TimeManager&) = delete;
+
+	// Starts the clock on the first call after pondering ends. Safe from any search thread.
+	void Poll();
+	bool Pondering() const;
+	bool HasClock() const;
+	std::chrono::steady_clock::time_point Deadline() const;
+	std::int64_t ElapsedMs() const;
+
+	// Times the first iteration from now rather than from construction, after other work
+	// such as a mate search has used part of the clock.
+	void StartIterations();
+	// best_move_permille is the best move's share of the iteration's nodes; zero if unknown.
+	void CompleteIteration(Move best_move, int score, int best_move_permille = 0);
+	std::int64_t SoftLimitMs() const;
+	// False once the soft limit has passed or the next iteration, predicted from the last one
+	// and the measured growth between the last two, would not finish in the time left to the
+	// hard deadline, where it would be aborted and thrown away.
+	bool ShouldStartIteration();
+
+	TimeStats Finish(bool hard_stopped) const;
+
+private:
+	using Ticks = std::chrono::steady_clock::rep;
+
+	std::chrono::steady_clock::time_point Start() const;
+
+	const std::atomic<bool>* pondering_ = nullptr;
+	std::atomic<bool> started_{false};
+	std::atomic<Ticks> start_ticks_{0};
+	std::atomic<Ticks> deadline_ticks_{0};
+	// Iterations are timed from here even before the clock starts.
+	std::chrono::steady_clock::time_point last_completion_;
+	std::int64_t optimum_ms_ = 0;
+	std::int64_t maximum_ms_ = 0;
+	int iterations_ = 0;
+	Move best_move_ = kNoMove;
+	int score_ = 0;
+	int stable_iterations_ = 0;
+	bool best_move_changed_ = false;
+	int score_drop_ = 0;
+	int best_move_permille_ = 0;
+	std::chrono::steady_clock::duration last_iteration_{};
+	std::chrono::steady_clock::duration previous_iteration_{};
+};
+
+}
+
@@ -1,15 +1,33 @@
 #include "transposition_table.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
 namespace flare {
 namespace {
 
-constexpr std::uint64_t kMoveMask = 0xFFFFFFFFULL;
+// Moves use the low 28 bits of their word; the top four tag the static eval's evaluator.
+constexpr std::uint64_t kMoveMask = 0x0FFFFFFFULL;
+constexpr std::uint64_t kEvalTagMask = 0xFULL;
+constexpr int kEvalTagShift = 28;
 constexpr std::uint64_t kScoreMask = 0xFFFFULL;
 constexpr std::uint64_t kDepthMask = 0xFFULL;
 constexpr std::uint64_t kBoundMask = 0x3ULL;
+constexpr std::uint64_t kGenerationMask = 0x3FULL;
+constexpr int kGenerationShift = 58;
 
 constexpr int kDepthBias = 1;
+constexpr char kFileMagic[8] = {'F', 'L', 'A', 'R', 'E', 'T', 'T', '\0'};
+constexpr std::uint32_t kFileVersion = 4;
 constexpr int kMaxDepthStored = 254;
+constexpr std::size_t kHashfullSample = 1000;
+// Searches that start within this long of each other on a shared table share a generation,
+// so the 6-bit counter does not wrap after a few moves with many processes attached.
+constexpr std::uint64_t kSharedEpochMs = 1000;
 
 int ClampScore(int score) {
 	if (score > 32767) {
@@ -21,6 +39,16 @@ int ClampScore(int score) {
 	return score;
 }
 
+std::uint64_t PackKeyWord(std::uint64_t key, int static_eval) {
+	std::uint16_t eval_bits =
+		static_cast<std::uint16_t>(static_cast<std::int16_t>(ClampScore(static_eval)));
+	return (key & ~kScoreMask) | eval_bits;
+}
+
+int UnpackStaticEval(std::uint64_t key_word) {
+	return static_cast<std::int16_t>(static_cast<std::uint16_t>(key_word & kScoreMask));
+}
+
 int ClampDepth(int depth) {
 	if (depth < 0) {
 		return 0;
@@ -31,8 +59,9 @@ int ClampDepth(int depth) {
 	return depth;
 }
 
-std::uint64_t PackEntry(Move best_move, int score, int depth, Bound bound) {
-	std::uint32_t move_bits = static_cast<std::uint32_t>(best_move);
+std::uint64_t PackEntry(Move best_move, int score, int depth, Bound bound,
+	std::uint8_t generation, std::uint8_t eval_tag) {
+	std::uint32_t move_bits = static_cast<std::uint32_t>(best_move & kMoveMask);
 	int clamped_score = ClampScore(score);
 	std::uint16_t score_bits = static_cast<std::uint16_t>(static_cast<std::int16_t>(clamped_score));
 	int clamped_depth = ClampDepth(depth);
@@ -41,9 +70,11 @@ std::uint64_t PackEntry(Move best_move, int score, int depth, Bound bound) {
 
 	std::uint64_t packed = 0;
 	packed |= static_cast<std::uint64_t>(move_bits);
+	packed |= (eval_tag & kEvalTagMask) << kEvalTagShift;
 	packed |= static_cast<std::uint64_t>(score_bits) << 32;
 	packed |= static_cast<std::uint64_t>(depth_bits) << 48;
 	packed |= static_cast<std::uint64_t>(bound_bits) << 56;
+	packed |= (generation & kGenerationMask) << kGenerationShift;
 	return packed;
 }
 
@@ -69,26 +100,95 @@ Bound UnpackBound(std::uint64_t packed) {
 	return static_cast<Bound>(bound_bits);
 }
 
+std::uint8_t UnpackEvalTag(std::uint64_t packed) {
+	return static_cast<std::uint8_t>((packed >> kEvalTagShift) & kEvalTagMask);
+}
+
+std::uint8_t UnpackGeneration(std::uint64_t packed) {
+	return static_cast<std::uint8_t>((packed >> kGenerationShift) & kGenerationMask);
+}
+
+static_assert(std::atomic_ref<std::uint64_t>::is_always_lock_free,
+	"shared tables need address-free 64-bit atomics");
+
+}
+
+TranspositionStats& TranspositionStats::operator+=(const TranspositionStats& other) {
+	probes += other.probes;
+	hits += other.hits;
+	cutoffs += other.cutoffs;
+	stores += other.stores;
+	replacements += other.replacements;
+	collisions += other.collisions;
+	return *this;
 }
 
 TranspositionTable::TranspositionTable()
-	: entries_(kEntryCount),
-	  mask_(kEntryCount - 1) {}
+	: mask_(kEntryCount - 1),
+	  heap_entries_(kEntryCount) {
+	entries_ = heap_entries_.data();
+	header_ = &heap_header_;
+}
+
+TranspositionTable::~TranspositionTable() {
+	Detach();
+}
 
 void TranspositionTable::Clear() {
-	for (auto& entry : entries_) {
-		entry.data.store(0, std::memory_order_relaxed);
-		entry.key.store(0, std::memory_order_relaxed);
+	for (std::size_t index = 0; index <= mask_; ++index) {
+		std::atomic_ref<std::uint64_t>(entries_[index].data).store(0, std::memory_order_relaxed);
+		std::atomic_ref<std::uint64_t>(entries_[index].key).store(0, std::memory_order_relaxed);
 	}
 }
 
-bool TranspositionTable::Probe(std::uint64_t key, TranspositionEntry& entry) const {
-	const auto& stored = entries_[key & mask_];
-	std::uint64_t stored_key = stored.key.load(std::memory_order_acquire);
-	if (stored_key != key) {
+void TranspositionTable::NewGame() {
+	if (storage_ == Storage::kShared) {
+		NewSearch();
+		return;
+	}
+	Clear();
+}
+
+void TranspositionTable::NewSearch() {
+	std::atomic_ref<std::uint32_t> generation(header_->generation);
+	if (storage_ != Storage::kShared) {
+		generation_ = static_cast<std::uint8_t>(
+			(generation.fetch_add(1, std::memory_order_relaxed) + 1) & kGenerationMask);
+		return;
+	}
+	// Only the process that claims a new epoch advances the generation; the others adopt it.
+	std::atomic_ref<std::uint64_t> epoch(header_->epoch_ms);
+	auto now = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+	std::uint64_t last = epoch.load(std::memory_order_relaxed);
+	if (now - last >= kSharedEpochMs &&
+		epoch.compare_exchange_strong(last, now, std::memory_order_acq_rel)) {
+		generation.fetch_add(1, std::memory_order_relaxed);
+	}
+	generation_ = static_cast<std::uint8_t>(
+		generation.load(std::memory_order_relaxed) & kGenerationMask);
+}
+
+void TranspositionTable::SetEvaluator(std::uint64_t evaluator) {
+	// Networks take tags 1 to 15, so two of them share a tag one time in fifteen.
+	eval_tag_ = evaluator == 0 ? 0 : static_cast<std::uint8_t>(1 + evaluator % kEvalTagMask);
+}
+
+// The key word holds (key | eval) ^ data, so a slot torn by concurrent writers (other threads
+// or other processes sharing the segment) fails verification instead of returning mixed data.
+bool TranspositionTable::Probe(std::uint64_t key, TranspositionEntry& entry,
+	TranspositionStats* stats) const {
+	if (stats) {
+		++stats->probes;
+	}
+	auto& stored = entries_[key & mask_];
+	std::uint64_t packed =
+		std::atomic_ref<std::uint64_t>(stored.data).load(std::memory_order_relaxed);
+	std::uint64_t key_word =
+		std::atomic_ref<std::uint64_t>(stored.key).load(std::memory_order_relaxed) ^ packed;
+	if ((key_word & ~kKeyEvalMask) != (key & ~kKeyEvalMask)) {
 		return false;
 	}
-	std::uint64_t packed = stored.data.load(std::memory_order_relaxed);
 	int depth = UnpackDepth(packed);
 	if (depth < 0) {
 		return false;
@@ -97,24 +197,227 @@ bool TranspositionTable::Probe(std::uint64_t key, TranspositionEntry& entry) con
 	entry.best_move = UnpackMove(packed);
 	entry.depth = depth;
 	entry.score = UnpackScore(packed);
+	entry.static_eval =
+		UnpackEvalTag(packed) == eval_tag_ ? UnpackStaticEval(key_word) : kNoStaticEval;
 	entry.bound = UnpackBound(packed);
+	if (stats) {
+		++stats->hits;
+	}
 	return true;
 }
 
 void TranspositionTable::Store(std::uint64_t key, int depth, int score, Bound bound,
-	Move best_move) {
+	Move best_move, int static_eval, TranspositionStats* stats) {
 	auto& stored = entries_[key & mask_];
-	std::uint64_t stored_key = stored.key.load(std::memory_order_relaxed);
-	if (stored_key == key) {
-		std::uint64_t stored_data = stored.data.load(std::memory_order_relaxed);
-		int stored_depth = UnpackDepth(stored_data);
+	std::atomic_ref<std::uint64_t> stored_key(stored.key);
+	std::atomic_ref<std::uint64_t> stored_data(stored.data);
+	std::uint64_t old_data = stored_data.load(std::memory_order_relaxed);
+	bool same_key = ((stored_key.load(std::memory_order_relaxed) ^ old_data) & ~kKeyEvalMask) ==
+		(key & ~kKeyEvalMask);
+	int stored_depth = UnpackDepth(old_data);
+	if (same_key) {
 		if (stored_depth > depth) {
 			return;
 		}
+	} else if (UnpackGeneration(old_data) == generation_ && stored_depth > depth + 2) {
+		return;
+	}
+	std::uint64_t packed = PackEntry(best_move, score, depth, bound, generation_, eval_tag_);
+	stored_data.store(packed, std::memory_order_relaxed);
+	stored_key.store(PackKeyWord(key, static_eval) ^ packed, std::memory_order_relaxed);
+	if (stats) {
+		++stats->stores;
+		if (!same_key && stored_depth >= 0) {
+			++stats->replacements;
+		}
+	}
+}
+
+int TranspositionTable::Hashfull() const {
+	std::size_t sample = std::min(kHashfullSample, mask_ + 1);
+	std::size_t used = 0;
+	for (std::size_t index = 0; index < sample; ++index) {
+		std::uint64_t packed =
+			std::atomic_ref<std::uint64_t>(entries_[index].data).load(std::memory_order_relaxed);
+		if (UnpackDepth(packed) >= 0 && UnpackGeneration(packed) == generation_) {
+			++used;
+		}
+	}
+	return static_cast<int>(used * 1000 / sample);
+}
+
+bool TranspositionTable::Save(const std::string& path) const {
+	std::ofstream output(path, std::ios::binary | std::ios::trunc);
+	if (!output) {
+		return false;
+	}
+	FileHeader header = MakeHeader();
+	output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	output.write(reinterpret_cast<const char*>(entries_),
+		static_cast<std::streamsize>((mask_ + 1) * sizeof(Slot)));
+	return static_cast<bool>(output);
+}
+
+bool TranspositionTable::Load(const std::string& path) {
+	MappedFile file;
+	if (!file.OpenReadOnly(path) ||
+		file.Size() != sizeof(FileHeader) + (mask_ + 1) * sizeof(Slot)) {
+		return false;
+	}
+	FileHeader header;
+	std::memcpy(&header, file.Data(), sizeof(header));
+	// Both checks run on the mapped bytes, so a bad file leaves the live table as it was.
+	const auto* slots = reinterpret_cast<const Slot*>(file.Data() + sizeof(header));
+	if (!ValidHeader(header) || Checksum(slots, mask_ + 1) != header.checksum) {
+		return false;
+	}
+	std::memcpy(entries_, slots, (mask_ + 1) * sizeof(Slot));
+	header_->generation = header.generation;
+	generation_ = static_cast<std::uint8_t>(header.generation & kGenerationMask);
+	return true;
+}
+
+bool TranspositionTable::MapFile(const std::string& path) {
+	Detach();
+	if (path.empty()) {
+		return true;
+	}
+	std::size_t table_bytes = (mask_ + 1) * sizeof(Slot);
+	MappedFile file;
+	bool created = false;
+	if (!file.OpenReadWrite(path, sizeof(FileHeader) + table_bytes, created)) {
+		return false;
+	}
+	auto* header = reinterpret_cast<FileHeader*>(file.Data());
+	auto* slots = reinterpret_cast<Slot*>(file.Data() + sizeof(FileHeader));
+	// Only a file this table made, or one with a table of the same size, is ever written.
+	if (!created && !ValidHeader(*header)) {
+		return false;
+	}
+	// A stale checksum means the previous owner never unmapped cleanly, so the
+	// contents cannot be trusted and the current heap table seeds the file instead.
+	if (created || Checksum(slots, mask_ + 1) != header->checksum) {
+		std::memcpy(slots, heap_entries_.data(), table_bytes);
+		*header = MakeHeader();
+	}
+	entries_ = slots;
+	header->checksum = 0;
+	file.Sync();
+	mapping_ = std::move(file);
+	header_ = header;
+	generation_ = static_cast<std::uint8_t>(header->generation & kGenerationMask);
+	storage_ = Storage::kFile;
+	heap_entries_.clear();
+	heap_entries_.shrink_to_fit();
+	return true;
+}
+
+bool TranspositionTable::MapShared(const std::string& name) {
+	Detach();
+	if (name.empty()) {
+		return true;
+	}
+	std::size_t table_bytes = (mask_ + 1) * sizeof(Slot);
+	MappedFile segment;
+	bool created = false;
+	if (!segment.OpenSharedMemory(name, sizeof(FileHeader) + table_bytes, created)) {
+		return false;
+	}
+	auto* header = reinterpret_cast<FileHeader*>(segment.Data());
+	std::atomic_ref<std::uint32_t> version(header->version);
+	if (created) {
+		std::memcpy(segment.Data() + sizeof(FileHeader), heap_entries_.data(), table_bytes);
+		FileHeader initial = MakeHeader();
+		initial.version = 0;
+		initial.checksum = 0;
+		std::memcpy(header, &initial, sizeof(initial));
+		version.store(kFileVersion, std::memory_order_release);
+	} else {
+		// Attaching processes wait for the creator to publish the header.
+		for (int attempt = 0; attempt < 100; ++attempt) {
+			if (version.load(std::memory_order_acquire) != 0) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if (!ValidHeader(*header)) {
+			return false;
+		}
+	}
+	std::atomic_ref<std::uint32_t>(header->attached).fetch_add(1, std::memory_order_acq_rel);
+	mapping_ = std::move(segment);
+	shared_name_ = name;
+	header_ = header;
+	entries_ = reinterpret_cast<Slot*>(mapping_.Data() + sizeof(FileHeader));
+	generation_ = static_cast<std::uint8_t>(
+		std::atomic_ref<std::uint32_t>(header->generation).load(std::memory_order_relaxed) &
+		kGenerationMask);
+	storage_ = Storage::kShared;
+	heap_entries_.clear();
+	heap_entries_.shrink_to_fit();
+	return true;
+}
+
+bool TranspositionTable::IsShared() const {
+	return storage_ == Storage::kShared;
+}
+
+std::uint64_t TranspositionTable::Checksum(const Slot* slots, std::size_t count) {
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+	for (std::size_t index = 0; index < count; ++index) {
+		hash = (hash ^ slots[index].key) * 0x100000001b3ULL;
+		hash = (hash ^ slots[index].data) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+std::uint64_t TranspositionTable::Checksum() const {
+	return Checksum(entries_, mask_ + 1);
+}
+
+TranspositionTable::FileHeader TranspositionTable::MakeHeader() const {
+	FileHeader header{};
+	std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+	header.version = kFileVersion;
+	header.slot_size = sizeof(Slot);
+	header.entry_count = mask_ + 1;
+	header.checksum = Checksum();
+	header.generation = header_->generation;
+	return header;
+}
+
+bool TranspositionTable::ValidHeader(const FileHeader& header) const {
+	return std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) == 0 &&
+		header.version == kFileVersion && header.slot_size == sizeof(Slot) &&
+		header.entry_count == mask_ + 1;
+}
+
+// Returns to private heap storage, keeping the current contents warm. Shared segments are
+// left in place while other processes are still attached.
+void TranspositionTable::Detach() {
+	if (storage_ == Storage::kHeap) {
+		return;
+	}
+	std::size_t table_bytes = (mask_ + 1) * sizeof(Slot);
+	heap_entries_.resize(mask_ + 1);
+	std::memcpy(heap_entries_.data(), entries_, table_bytes);
+	heap_header_.generation = header_->generation;
+	if (storage_ == Storage::kFile) {
+		header_->checksum = Checksum();
+		mapping_.Sync();
+	}
+	// A process attaching between the last detach and the unlink keeps a private segment;
+	// later ones create a fresh shared one.
+	if (storage_ == Storage::kShared &&
+		std::atomic_ref<std::uint32_t>(header_->attached).fetch_sub(1,
+			std::memory_order_acq_rel) == 1) {
+		MappedFile::UnlinkSharedMemory(shared_name_);
 	}
-	std::uint64_t packed = PackEntry(best_move, score, depth, bound);
-	stored.data.store(packed, std::memory_order_relaxed);
-	stored.key.store(key, std::memory_order_release);
+	shared_name_.clear();
+	mapping_.Close();
+	entries_ = heap_entries_.data();
+	header_ = &heap_header_;
+	storage_ = Storage::kHeap;
 }
 
 }
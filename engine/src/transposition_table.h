@@ -1,10 +1,11 @@
 #pragma once
 
-#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <string>
 #include <vector>
 
+#include "mapped_file.h"
 #include "move.h"
 
 namespace flare {
@@ -15,32 +16,113 @@ enum class Bound : std::uint8_t {
 	kUpper = 2,
 };
 
+constexpr int kNoStaticEval = -32768;
+
 struct TranspositionEntry {
 	std::uint64_t key = 0;
 	Move best_move = kNoMove;
 	int depth = -1;
 	int score = 0;
+	int static_eval = kNoStaticEval;
 	Bound bound = Bound::kExact;
 };
 
+struct TranspositionStats {
+	std::uint64_t probes = 0;
+	std::uint64_t hits = 0;
+	std::uint64_t cutoffs = 0;
+	std::uint64_t stores = 0;
+	std::uint64_t replacements = 0;
+	std::uint64_t collisions = 0;
+
+	TranspositionStats& operator+=(const TranspositionStats& other);
+};
+
 class TranspositionTable {
 public:
 	TranspositionTable();
+	~TranspositionTable();
+
+	TranspositionTable(const TranspositionTable&) = delete;
+	TranspositionTable& operator=(const TranspositionTable&) = delete;
 
 	void Clear();
-	bool Probe(std::uint64_t key, TranspositionEntry& entry) const;
-	void Store(std::uint64_t key, int depth, int score, Bound bound, Move best_move);
+	// Starts a new game. A shared table only advances the generation, so other engine
+	// processes attached to the same segment keep their entries.
+	void NewGame();
+	void NewSearch();
+	// Tags the static evals stored from now on with the evaluator that produced them: zero
+	// for the classical evaluation, a network fingerprint otherwise. Probes drop evals with
+	// another tag, so a table shared with or saved by a different evaluator only lends its
+	// search results.
+	void SetEvaluator(std::uint64_t evaluator);
+	bool Probe(std::uint64_t key, TranspositionEntry& entry,
+		TranspositionStats* stats = nullptr) const;
+	void Store(std::uint64_t key, int depth, int score, Bound bound, Move best_move,
+		int static_eval, TranspositionStats* stats = nullptr);
+	// Per-mille of sampled slots holding an entry from the current generation.
+	int Hashfull() const;
+
+	// Snapshots use a versioned header followed by the raw slots and a checksum over them.
+	bool Save(const std::string& path) const;
+	bool Load(const std::string& path);
+	// Backs the table with a memory-mapped snapshot file; an empty path returns to heap storage.
+	bool MapFile(const std::string& path);
+	// Attaches to a named POSIX shared-memory table; an empty name returns to heap storage.
+	// The segment is removed when the last attached process detaches; one left behind by a
+	// crashed process stays until the next detach or a reboot.
+	bool MapShared(const std::string& name);
+	bool IsShared() const;
 
 private:
-	struct AtomicEntry {
-		std::atomic<std::uint64_t> key{0};
-		std::atomic<std::uint64_t> data{0};
+	struct Slot {
+		std::uint64_t key;
+		std::uint64_t data;
+	};
+
+	struct FileHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t slot_size;
+		std::uint64_t entry_count;
+		std::uint64_t checksum;
+		std::uint32_t generation;
+		// Processes attached to a shared segment; the last one to detach removes it.
+		std::uint32_t attached;
+		// When a shared table last advanced its generation, in steady-clock milliseconds.
+		std::uint64_t epoch_ms;
+		std::uint8_t reserved[16];
+	};
+
+	enum class Storage : std::uint8_t {
+		kHeap,
+		kFile,
+		kShared,
 	};
 
 	static constexpr std::size_t kEntryCount = 1 << 18;
+	// The low key bits are implied by the slot index, so the key word reuses them for the
+	// static evaluation.
+	static constexpr std::uint64_t kKeyEvalMask = 0xFFFF;
+	static_assert(kEntryCount > kKeyEvalMask, "slot index must cover the eval bits");
+
+	static std::uint64_t Checksum(const Slot* slots, std::size_t count);
+	std::uint64_t Checksum() const;
+	FileHeader MakeHeader() const;
+	bool ValidHeader(const FileHeader& header) const;
+	void Detach();
 
-	std::vector<AtomicEntry> entries_;
+	Slot* entries_ = nullptr;
+	FileHeader* header_ = nullptr;
 	std::size_t mask_ = 0;
+	std::uint8_t generation_ = 0;
+	std::uint8_t eval_tag_ = 0;
+	Storage storage_ = Storage::kHeap;
+	std::string shared_name_;
+	FileHeader heap_header_{};
+	std::vector<Slot> heap_entries_;
+	MappedFile mapping_;
 };
 
 }
+
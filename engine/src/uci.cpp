@@ -2,20 +2,30 @@
 
 #include <algorithm>
 #include <atomic>
+#include <bit>
 #include <chrono>
 #include <cctype>
 #include <charconv>
+#include <condition_variable>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "attack.h"
+#include "bitboard.h"
+#include "eval.h"
 #include "fen.h"
+#include "mate_solver.h"
 #include "movegen.h"
+#include "nnue.h"
 #include "search.h"
+#include "time_manager.h"
 #include "transposition_table.h"
 
 namespace flare {
@@ -23,19 +33,52 @@ namespace {
 
 constexpr std::string_view kStartFen =
 	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+constexpr int kMaxMultiPv = 64;
+// Ends a searchmoves list.
+const std::unordered_set<std::string_view> kGoKeywords = {"searchmoves", "ponder", "wtime",
+	"btime", "winc", "binc", "movestogo", "depth", "nodes", "mate", "movetime", "infinite"};
 
 struct UciState {
 	Position position;
 	TranspositionTable table;
+	nnue::Network network;
+	bool use_nnue = false;
+	MateSolver mate_solver;
+	bool use_mate_solver = true;
+	// One per search thread, so evaluation and pawn caches stay warm from move to move.
+	std::vector<EvalContext> eval_contexts;
+	// The last position command's base, "startpos" or "fen ...", and the moves applied to
+	// it with what undoes them. An empty base forces the next position command to reload.
+	std::string position_base;
+	std::vector<std::string> position_moves;
+	std::vector<Move> played_moves;
+	std::vector<MoveState> position_states;
 	int threads = 1;
+	int multipv = 1;
 	int default_depth = 4;
 	std::atomic<bool> stop{false};
+	// Set by go ponder and cleared by ponderhit or stop, both under ponder_mutex so a
+	// finished ponder search waiting on ponder_ended cannot miss the change.
+	std::atomic<bool> pondering{false};
+	std::mutex ponder_mutex;
+	std::condition_variable ponder_ended;
 	bool search_active = false;
+	bool search_infinite = false;
 	std::thread search_thread;
+	// Serializes whole lines from the search thread and the input thread.
+	std::mutex output_mutex;
+	std::mutex stats_mutex;
+	TranspositionStats last_tt_stats;
+	EvalStats last_eval_stats;
+	TimeStats last_time_stats;
+	int last_hashfull = 0;
+	// From raising the stop flag to the search thread having reported, for the last stop.
+	std::int64_t last_stop_wait_us = 0;
 };
 
 struct GoLimits {
 	bool infinite = false;
+	bool ponder = false;
 	int depth = 0;
 	int movetime = 0;
 	int wtime = 0;
@@ -43,6 +86,9 @@ struct GoLimits {
 	int winc = 0;
 	int binc = 0;
 	int movestogo = 0;
+	std::uint64_t nodes = 0;
+	int mate = 0;
+	std::vector<std::string> search_moves;
 };
 
 std::vector<std::string> SplitTokens(const std::string& line) {
@@ -55,11 +101,12 @@ std::vector<std::string> SplitTokens(const std::string& line) {
 	return tokens;
 }
 
-bool ParseInt(std::string_view text, int& value) {
+template <typename Integer>
+bool ParseInt(std::string_view text, Integer& value) {
 	if (text.empty()) {
 		return false;
 	}
-	int parsed = 0;
+	Integer parsed = 0;
 	auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), parsed);
 	if (ec != std::errc() || ptr != text.data() + text.size()) {
 		return false;
@@ -68,7 +115,9 @@ bool ParseInt(std::string_view text, int& value) {
 	return true;
 }
 
-bool ExtractTokenInt(const std::vector<std::string>& tokens, std::string_view key, int& value) {
+template <typename Integer>
+bool ExtractTokenInt(const std::vector<std::string>& tokens, std::string_view key,
+	Integer& value) {
 	for (std::size_t i = 0; i + 1 < tokens.size(); ++i) {
 		if (tokens[i] == key) {
 			return ParseInt(tokens[i + 1], value);
@@ -77,60 +126,71 @@ bool ExtractTokenInt(const std::vector<std::string>& tokens, std::string_view ke
 	return false;
 }
 
-bool ApplyUciMove(Position& position, std::string_view uci) {
-	std::vector<Move> moves;
-	GenerateLegalMoves(position, moves);
-	for (Move move : moves) {
-		if (MoveToUci(move) == uci) {
-			MoveState state;
-			MakeMove(position, move, state);
-			return true;
-		}
-	}
-	return false;
-}
-
-void ApplyMoves(Position& position, const std::vector<std::string>& moves, std::size_t start) {
-	for (std::size_t i = start; i < moves.size(); ++i) {
-		if (!ApplyUciMove(position, moves[i])) {
-			break;
+std::string JoinTokens(const std::vector<std::string>& tokens, std::size_t start) {
+	std::string joined;
+	for (std::size_t i = start; i < tokens.size(); ++i) {
+		if (!joined.empty()) {
+			joined.push_back(' ');
 		}
+		joined.append(tokens[i]);
 	}
+	return joined;
 }
 
+// Moves past the common prefix with the last position command are undone and only the new
+// ones applied, so a GUI resending the whole game every move costs one move, not the game.
 bool SetPositionFromTokens(UciState& state, const std::vector<std::string>& tokens) {
-	if (tokens.size() < 2) {
+	if (tokens.size() < 2 || (tokens[1] != "startpos" && tokens[1] != "fen")) {
 		return false;
 	}
-	if (tokens[1] == "startpos") {
-		state.position.SetStartPosition();
-		std::size_t moves_index = 2;
-		if (moves_index < tokens.size() && tokens[moves_index] == "moves") {
-			ApplyMoves(state.position, tokens, moves_index + 1);
+	std::size_t moves_index = 2;
+	while (moves_index < tokens.size() && tokens[moves_index] != "moves") {
+		++moves_index;
+	}
+	std::string fen;
+	for (std::size_t i = 2; i < moves_index; ++i) {
+		if (!fen.empty()) {
+			fen.push_back(' ');
 		}
-		return true;
+		fen.append(tokens[i]);
 	}
-	if (tokens[1] == "fen") {
-		std::string fen;
-		std::size_t index = 2;
-		for (; index < tokens.size(); ++index) {
-			if (tokens[index] == "moves") {
-				break;
-			}
-			if (!fen.empty()) {
-				fen.push_back(' ');
-			}
-			fen.append(tokens[index]);
+	std::string base = tokens[1] == "startpos" ? "startpos" : "fen " + fen;
+	std::size_t first_move = std::min(moves_index + 1, tokens.size());
+	std::size_t common = 0;
+	if (!state.position_base.empty() && base == state.position_base) {
+		while (common < state.position_moves.size() && first_move + common < tokens.size() &&
+			tokens[first_move + common] == state.position_moves[common]) {
+			++common;
 		}
-		if (!LoadFen(state.position, fen)) {
+		while (state.played_moves.size() > common) {
+			UndoMove(state.position, state.played_moves.back(), state.position_states.back());
+			state.played_moves.pop_back();
+			state.position_states.pop_back();
+			state.position_moves.pop_back();
+		}
+	} else {
+		state.position_base.clear();
+		state.position_moves.clear();
+		state.played_moves.clear();
+		state.position_states.clear();
+		if (tokens[1] == "startpos") {
+			state.position.SetStartPosition();
+		} else if (!LoadFen(state.position, fen)) {
 			return false;
 		}
-		if (index < tokens.size() && tokens[index] == "moves") {
-			ApplyMoves(state.position, tokens, index + 1);
+		state.position_base = base;
+	}
+	for (std::size_t i = first_move + common; i < tokens.size(); ++i) {
+		Move move = ParseUciMove(state.position, tokens[i]);
+		if (move == kNoMove) {
+			break;
 		}
-		return true;
+		state.position_states.emplace_back();
+		MakeMove(state.position, move, state.position_states.back());
+		state.played_moves.push_back(move);
+		state.position_moves.push_back(tokens[i]);
 	}
-	return false;
+	return true;
 }
 
 void HandleSetOption(UciState& state, const std::vector<std::string>& tokens) {
@@ -153,13 +213,60 @@ void HandleSetOption(UciState& state, const std::vector<std::string>& tokens) {
 		}
 		name.append(tokens[i]);
 	}
-	std::string value = tokens[value_index];
+	std::string value = JoinTokens(tokens, value_index);
 	if (name == "Threads") {
 		int parsed = 0;
 		if (ParseInt(value, parsed)) {
 			state.threads = std::max(1, parsed);
 		}
+	} else if (name == "MultiPV") {
+		int parsed = 0;
+		if (ParseInt(value, parsed)) {
+			state.multipv = std::clamp(parsed, 1, kMaxMultiPv);
+		}
+	} else if (name == "HashFile") {
+		std::string path = value == "<empty>" ? std::string() : value;
+		if (!state.table.MapFile(path)) {
+			std::cout << "info string failed to map hash file " << path << "\n";
+		}
+	} else if (name == "UseNNUE") {
+		state.use_nnue = value == "true";
+		if (state.use_nnue && !state.network.IsLoaded()) {
+			std::cout << "info string no network loaded, set EvalFile first\n";
+		}
+	} else if (name == "EvalFile") {
+		if (value == "<empty>" || !state.network.Load(value)) {
+			std::cout << "info string failed to load network " << value << "\n";
+		} else {
+			std::cout << "info string loaded network " << value << " kernel "
+				<< nnue::KernelName(state.network.ActiveKernel()) << "\n";
+		}
+	} else if (name == "MateSolver") {
+		state.use_mate_solver = value == "true";
+	} else if (name == "SharedHash") {
+		std::string segment = value == "<empty>" ? std::string() : value;
+		if (!state.table.MapShared(segment)) {
+			std::cout << "info string failed to attach shared hash " << segment << "\n";
+		}
+	}
+}
+
+void HandleSaveHash(const UciState& state, const std::vector<std::string>& tokens) {
+	std::string path = JoinTokens(tokens, 1);
+	if (path.empty() || !state.table.Save(path)) {
+		std::cout << "info string savehash failed\n";
+		return;
 	}
+	std::cout << "info string hash saved to " << path << "\n";
+}
+
+void HandleLoadHash(UciState& state, const std::vector<std::string>& tokens) {
+	std::string path = JoinTokens(tokens, 1);
+	if (path.empty() || !state.table.Load(path)) {
+		std::cout << "info string loadhash failed\n";
+		return;
+	}
+	std::cout << "info string hash loaded from " << path << "\n";
 }
 
 GoLimits ParseGoLimits(const std::vector<std::string>& tokens) {
@@ -171,76 +278,277 @@ GoLimits ParseGoLimits(const std::vector<std::string>& tokens) {
 	ExtractTokenInt(tokens, "winc", limits.winc);
 	ExtractTokenInt(tokens, "binc", limits.binc);
 	ExtractTokenInt(tokens, "movestogo", limits.movestogo);
+	ExtractTokenInt(tokens, "nodes", limits.nodes);
+	ExtractTokenInt(tokens, "mate", limits.mate);
+	bool in_search_moves = false;
 	for (const auto& token : tokens) {
 		if (token == "infinite") {
 			limits.infinite = true;
-			break;
+		} else if (token == "ponder") {
+			limits.ponder = true;
+		} else if (token == "searchmoves") {
+			in_search_moves = true;
+			continue;
+		} else if (in_search_moves && !kGoKeywords.contains(token)) {
+			limits.search_moves.push_back(token);
+			continue;
 		}
+		in_search_moves = false;
 	}
 	return limits;
 }
 
-int AllocateTimeMs(const GoLimits& limits, Color side_to_move) {
-	if (limits.movetime > 0) {
-		return std::max(1, limits.movetime);
+const nnue::Network* ActiveNetwork(const UciState& state) {
+	return state.use_nnue && state.network.IsLoaded() ? &state.network : nullptr;
+}
+
+// The search thread reports while the input thread keeps answering commands, so every
+// block of lines goes out whole under one lock.
+void Emit(UciState& state, const std::string& text) {
+	std::lock_guard<std::mutex> guard(state.output_mutex);
+	std::cout << text;
+	std::cout.flush();
+}
+
+// Joins the search thread after it reports on its own.
+void WaitSearch(UciState& state) {
+	if (!state.search_active) {
+		return;
 	}
-	int remaining = side_to_move == Color::kWhite ? limits.wtime : limits.btime;
-	int increment = side_to_move == Color::kWhite ? limits.winc : limits.binc;
-	if (remaining <= 0) {
-		return 0;
+	if (state.search_thread.joinable()) {
+		state.search_thread.join();
 	}
-	int moves_to_go = limits.movestogo > 0 ? limits.movestogo : 30;
-	int slice = remaining / std::max(1, moves_to_go);
-	int budget = slice + increment;
-	budget = static_cast<int>(budget * 0.9);
-	int max_budget = std::max(1, remaining - 10);
-	if (budget <= 0) {
-		budget = 1;
+	state.search_active = false;
+}
+
+// Releases a ponder search to play on, or to report if it already finished.
+void EndPonder(UciState& state) {
+	{
+		std::lock_guard<std::mutex> guard(state.ponder_mutex);
+		state.pondering.store(false, std::memory_order_relaxed);
 	}
-	return std::min(budget, max_budget);
+	state.ponder_ended.notify_all();
 }
 
 void StopSearch(UciState& state) {
 	if (!state.search_active) {
 		return;
 	}
+	auto start = std::chrono::steady_clock::now();
 	state.stop.store(true, std::memory_order_relaxed);
-	if (state.search_thread.joinable()) {
-		state.search_thread.join();
+	EndPonder(state);
+	WaitSearch(state);
+	std::lock_guard<std::mutex> guard(state.stats_mutex);
+	state.last_stop_wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+std::string FormatTtStats(const TranspositionStats& stats) {
+	std::ostringstream output;
+	output << "probes " << stats.probes << " hits " << stats.hits << " cutoffs " << stats.cutoffs
+		<< " stores " << stats.stores << " replacements " << stats.replacements
+		<< " collisions " << stats.collisions;
+	return output.str();
+}
+
+std::string FormatTimeStats(const TimeStats& stats) {
+	std::ostringstream output;
+	output << "optimum " << stats.optimum_ms << " maximum " << stats.maximum_ms << " soft "
+		<< stats.soft_limit_ms << " elapsed " << stats.elapsed_ms << " iterations "
+		<< stats.iterations << " overshoot " << stats.overshoot_ms << " stop_latency_us "
+		<< stats.stop_latency_us;
+	return output.str();
+}
+
+std::string FormatEvalStats(const EvalStats& stats) {
+	std::uint64_t total = stats.lazy + stats.full;
+	std::ostringstream output;
+	output << "lazy " << stats.lazy << " full " << stats.full << " lazy_permille "
+		<< (total == 0 ? 0 : stats.lazy * 1000 / total) << " cache_probes " << stats.cache_probes
+		<< " cache_hits " << stats.cache_hits << " cache_permille "
+		<< (stats.cache_probes == 0 ? 0 : stats.cache_hits * 1000 / stats.cache_probes);
+	return output.str();
+}
+
+// "mate N" for a forced mate, "cp S" otherwise.
+std::string FormatScore(int score) {
+	int mate = MateInMoves(score);
+	return mate != 0 ? "mate " + std::to_string(mate) : "cp " + std::to_string(score);
+}
+
+// One info line per MultiPV line of a completed iteration.
+void ReportIteration(UciState& state, const SearchResult& result) {
+	std::ostringstream output;
+	for (std::size_t index = 0; index < result.lines.size(); ++index) {
+		const PvLine& line = result.lines[index];
+		output << "info depth " << result.depth << " multipv " << index + 1 << " score "
+			<< FormatScore(line.score) << " nodes " << result.nodes << " pv";
+		for (Move move : line.pv) {
+			output << " " << MoveToUci(move);
+		}
+		output << "\n";
 	}
-	state.search_active = false;
+	Emit(state, output.str());
 }
 
-void PrintUciId(const UciState& state) {
-	std::cout << "id name Flare Engine\n";
-	std::cout << "id author Flare Engine\n";
-	std::cout << "option name Threads type spin default " << state.threads
-		<< " min 1 max 128\n";
-	std::cout << "uciok\n";
+void ReportResult(UciState& state, const SearchResult& result) {
+	{
+		std::lock_guard<std::mutex> guard(state.stats_mutex);
+		state.last_tt_stats = result.tt_stats;
+		state.last_eval_stats = result.eval_stats;
+		state.last_time_stats = result.time_stats;
+		state.last_hashfull = result.hashfull;
+	}
+	std::ostringstream output;
+	// A search stopped before its first move has no score to give.
+	if (IsSearchScore(result.score)) {
+		output << "info depth " << result.depth << " score " << FormatScore(result.score)
+			<< " nodes " << result.nodes << " hashfull " << result.hashfull << "\n";
+	}
+	output << "bestmove " << MoveToUci(result.best_move);
+	if (result.ponder_move != kNoMove) {
+		output << " ponder " << MoveToUci(result.ponder_move);
+	}
+	output << "\n";
+	Emit(state, output.str());
 }
 
-void PrintLegalMoves(Position& position) {
+// Every go runs on the search thread so stop, isready and quit are read while it thinks.
+// A ponder search never reports before ponderhit or stop, even if it runs out of depth.
+void StartSearch(UciState& state, SearchLimits limits, bool ponder) {
+	state.stop.store(false, std::memory_order_relaxed);
+	state.pondering.store(ponder, std::memory_order_relaxed);
+	limits.stop = &state.stop;
+	limits.pondering = ponder ? &state.pondering : nullptr;
+	limits.multipv = state.multipv;
+	limits.on_iteration = [&state](const SearchResult& result) {
+		ReportIteration(state, result);
+	};
+	limits.network = ActiveNetwork(state);
+	limits.mate_solver = state.use_mate_solver ? &state.mate_solver : nullptr;
+	limits.eval_contexts = &state.eval_contexts;
+	Position position = state.position;
+	int threads = state.threads;
+	state.search_active = true;
+	state.search_infinite = limits.infinite || ponder;
+	state.search_thread = std::thread([&state, position, limits, threads]() mutable {
+		SearchResult result = Search(position, limits, state.table, threads);
+		{
+			std::unique_lock<std::mutex> lock(state.ponder_mutex);
+			state.ponder_ended.wait(lock, [&state]() {
+				return !state.pondering.load(std::memory_order_relaxed);
+			});
+		}
+		ReportResult(state, result);
+	});
+}
+
+void HandleDebug(UciState& state, const std::vector<std::string>& tokens) {
+	if (tokens.size() < 2) {
+		return;
+	}
+	std::ostringstream output;
+	{
+		std::lock_guard<std::mutex> guard(state.stats_mutex);
+		if (tokens[1] == "tt") {
+			output << "info string tt " << FormatTtStats(state.last_tt_stats) << " hashfull "
+				<< state.last_hashfull << "\n";
+		} else if (tokens[1] == "eval") {
+			output << "info string eval " << FormatEvalStats(state.last_eval_stats) << "\n";
+		} else if (tokens[1] == "time") {
+			output << "info string time " << FormatTimeStats(state.last_time_stats)
+				<< " stop_wait_us " << state.last_stop_wait_us << "\n";
+		}
+	}
+	Emit(state, output.str());
+}
+
+void PrintUciId(UciState& state) {
+	std::ostringstream output;
+	output << "id name Flare Engine\n";
+	output << "id author Flare Engine\n";
+	output << "option name Threads type spin default " << state.threads << " min 1 max 128\n";
+	output << "option name MultiPV type spin default 1 min 1 max " << kMaxMultiPv << "\n";
+	output << "option name HashFile type string default <empty>\n";
+	output << "option name SharedHash type string default <empty>\n";
+	output << "option name UseNNUE type check default false\n";
+	output << "option name EvalFile type string default <empty>\n";
+	output << "option name Ponder type check default false\n";
+	output << "option name MateSolver type check default true\n";
+	output << "uciok\n";
+	Emit(state, output.str());
+}
+
+void PrintLegalMoves(UciState& state) {
 	std::vector<Move> moves;
-	GenerateLegalMoves(position, moves);
-	std::cout << "legalmoves";
+	GenerateLegalMoves(state.position, moves);
+	std::string output = "legalmoves";
 	for (Move move : moves) {
-		std::cout << " " << MoveToUci(move);
+		output.append(" ").append(MoveToUci(move));
 	}
-	std::cout << "\n";
+	Emit(state, output + "\n");
 }
 
-void PrintFen(const Position& position) {
-	std::cout << "fen " << ToFen(position) << "\n";
+void PrintFen(UciState& state) {
+	Emit(state, "fen " + ToFen(state.position) + "\n");
 }
 
-void PrintInCheck(const Position& position) {
+void PrintInCheck(UciState& state) {
+	const Position& position = state.position;
 	bool in_check = false;
 	Square king_square = position.KingSquare(position.side_to_move_);
 	if (king_square != Square::kNoSquare) {
 		in_check = IsSquareAttacked(position, king_square,
 			OppositeColor(position.side_to_move_));
 	}
-	std::cout << "incheck " << (in_check ? 1 : 0) << "\n";
+	Emit(state, in_check ? "incheck 1\n" : "incheck 0\n");
+}
+
+// Neither side can mate with a lone minor piece or less.
+bool IsInsufficientMaterial(const Position& position) {
+	int minors = 0;
+	for (int color = 0; color < kColorCount; ++color) {
+		const auto& pieces = position.piece_bb_[color];
+		if (pieces[ToIndex(PieceType::kPawn)] | pieces[ToIndex(PieceType::kRook)] |
+			pieces[ToIndex(PieceType::kQueen)]) {
+			return false;
+		}
+		minors += std::popcount(pieces[ToIndex(PieceType::kKnight)] |
+			pieces[ToIndex(PieceType::kBishop)]);
+	}
+	return minors <= 1;
+}
+
+// Everything a GUI needs after a move in one line from one move generation:
+// state result <r> incheck <0|1> fen <fen> legalmoves <moves...>
+// where r is none, checkmate, stalemate, fifty, repetition or material.
+void PrintState(UciState& state) {
+	Position& position = state.position;
+	Color us = position.side_to_move_;
+	AttackInfo info;
+	ComputeAttackInfo(position, info);
+	std::vector<Move> moves;
+	GenerateLegalMoves(position, moves, info);
+	Square king_square = position.KingSquare(us);
+	bool in_check = king_square != Square::kNoSquare &&
+		HasBit(info.attacked[ToIndex(OppositeColor(us))], king_square);
+	std::string_view result = "none";
+	if (moves.empty()) {
+		result = in_check ? "checkmate" : "stalemate";
+	} else if (position.halfmove_clock_ >= 100) {
+		result = "fifty";
+	} else if (position.IsDraw(0)) {
+		result = "repetition";
+	} else if (IsInsufficientMaterial(position)) {
+		result = "material";
+	}
+	std::string output = "state result ";
+	output.append(result).append(in_check ? " incheck 1" : " incheck 0");
+	output.append(" fen ").append(ToFen(position)).append(" legalmoves");
+	for (Move move : moves) {
+		output.append(" ").append(MoveToUci(move));
+	}
+	Emit(state, output + "\n");
 }
 
 }
@@ -261,11 +569,13 @@ int RunUciLoop() {
 		if (command == "uci") {
 			PrintUciId(state);
 		} else if (command == "isready") {
-			std::cout << "readyok\n";
+			Emit(state, "readyok\n");
 		} else if (command == "ucinewgame") {
 			StopSearch(state);
-			state.table.Clear();
+			state.table.NewGame();
+			state.mate_solver.Clear();
 			state.position.SetStartPosition();
+			state.position_base.clear();
 		} else if (command == "setoption") {
 			StopSearch(state);
 			HandleSetOption(state, tokens);
@@ -273,56 +583,66 @@ int RunUciLoop() {
 			StopSearch(state);
 			SetPositionFromTokens(state, tokens);
 		} else if (command == "legalmoves") {
-			PrintLegalMoves(state.position);
+			PrintLegalMoves(state);
 		} else if (command == "fen") {
-			PrintFen(state.position);
+			PrintFen(state);
 		} else if (command == "incheck") {
-			PrintInCheck(state.position);
+			PrintInCheck(state);
+		} else if (command == "state") {
+			PrintState(state);
+		} else if (command == "debug") {
+			HandleDebug(state, tokens);
+		} else if (command == "savehash") {
+			StopSearch(state);
+			HandleSaveHash(state, tokens);
+		} else if (command == "loadhash") {
+			StopSearch(state);
+			HandleLoadHash(state, tokens);
 		} else if (command == "stop") {
 			StopSearch(state);
 		} else if (command == "go") {
 			GoLimits limits = ParseGoLimits(tokens);
 			StopSearch(state);
-			bool has_time = limits.movetime > 0 || limits.wtime > 0 || limits.btime > 0;
+			bool white = state.position.side_to_move_ == Color::kWhite;
+			TimeBudget budget = AllocateTime(white ? limits.wtime : limits.btime,
+				white ? limits.winc : limits.binc, limits.movestogo);
+			SearchLimits search_limits;
 			if (limits.infinite) {
-				state.stop.store(false, std::memory_order_relaxed);
-				Position position = state.position;
-				int threads = state.threads;
-				SearchLimits search_limits;
 				search_limits.infinite = true;
-				search_limits.stop = &state.stop;
-				state.search_active = true;
-				state.search_thread = std::thread([&, position, search_limits, threads]() mutable {
-					SearchResult result = Search(position, search_limits, state.table, threads);
-					std::cout << "info depth " << result.depth << " score cp " << result.score
-						<< " nodes " << result.nodes << "\n";
-					std::cout << "bestmove " << MoveToUci(result.best_move) << "\n";
-					std::cout.flush();
-				});
+			} else if (limits.movetime > 0) {
+				search_limits.max_depth = limits.depth;
+				search_limits.time_ms = limits.movetime;
+			} else if (budget.maximum_ms > 0) {
+				search_limits.max_depth = limits.depth;
+				search_limits.optimum_ms = budget.optimum_ms;
+				search_limits.time_ms = budget.maximum_ms;
+			} else if (limits.nodes > 0 || limits.mate > 0) {
+				search_limits.max_depth = limits.depth;
 			} else {
-				SearchResult result;
-				if (has_time) {
-					SearchLimits search_limits;
-					search_limits.max_depth = limits.depth;
-					search_limits.time_ms = AllocateTimeMs(limits, state.position.side_to_move_);
-					if (search_limits.time_ms <= 0) {
-						search_limits.max_depth = limits.depth > 0 ? limits.depth : state.default_depth;
-					}
-					result = Search(state.position, search_limits, state.table, state.threads);
-				} else {
-					int depth = limits.depth > 0 ? limits.depth : state.default_depth;
-					result = Search(state.position, depth, state.table, state.threads);
+				search_limits.max_depth = limits.depth > 0 ? limits.depth : state.default_depth;
+			}
+			search_limits.nodes = limits.nodes;
+			search_limits.mate = std::max(0, limits.mate);
+			for (const std::string& uci : limits.search_moves) {
+				if (Move move = ParseUciMove(state.position, uci); move != kNoMove) {
+					search_limits.search_moves.push_back(move);
 				}
-				std::cout << "info depth " << result.depth << " score cp " << result.score
-					<< " nodes " << result.nodes << "\n";
-				std::cout << "bestmove " << MoveToUci(result.best_move) << "\n";
 			}
+			StartSearch(state, search_limits, limits.ponder);
+		} else if (command == "ponderhit") {
+			EndPonder(state);
 		} else if (command == "quit") {
 			StopSearch(state);
 			break;
 		}
 		std::cout.flush();
 	}
+	// End of input: a bounded search still owes its bestmove, an infinite one is stopped.
+	if (state.search_infinite) {
+		StopSearch(state);
+	} else {
+		WaitSearch(state);
+	}
 	return 0;
 }
 
@@ -335,6 +655,8 @@ int RunBench(int depth, int threads) {
 
 	TranspositionTable table;
 	std::uint64_t total_nodes = 0;
+	TranspositionStats total_tt_stats;
+	EvalStats total_eval_stats;
 	auto bench_start = std::chrono::steady_clock::now();
 
 	for (const auto& [name, fen] : positions) {
@@ -348,8 +670,13 @@ int RunBench(int depth, int threads) {
 		auto end = std::chrono::steady_clock::now();
 		auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
 		total_nodes += result.nodes;
+		total_tt_stats += result.tt_stats;
+		total_eval_stats += result.eval_stats;
 		std::cout << "bench " << name << " depth " << depth << " score " << result.score
 			<< " nodes " << result.nodes << " time_ms " << elapsed_ms.count() << "\n";
+		std::cout << "bench " << name << " tt " << FormatTtStats(result.tt_stats)
+			<< " hashfull " << result.hashfull << "\n";
+		std::cout << "bench " << name << " eval " << FormatEvalStats(result.eval_stats) << "\n";
 	}
 
 	auto bench_end = std::chrono::steady_clock::now();
@@ -357,7 +684,153 @@ int RunBench(int depth, int threads) {
 	std::uint64_t nps = total_ms.count() == 0 ? 0 : (total_nodes * 1000 / total_ms.count());
 	std::cout << "bench total nodes " << total_nodes << " time_ms " << total_ms.count()
 		<< " nps " << nps << "\n";
+	std::cout << "bench total tt " << FormatTtStats(total_tt_stats) << "\n";
+	std::cout << "bench total eval " << FormatEvalStats(total_eval_stats) << "\n";
+	return 0;
+}
+
+int RunEvalBatch(const std::string& path, int threads, const std::string& network_path) {
+	constexpr std::size_t kChunkLines = 1 << 16;
+
+	nnue::Network network;
+	if (!network_path.empty() && !network.Load(network_path)) {
+		std::cerr << "evalbatch failed to load network " << network_path << "\n";
+		return 1;
+	}
+	std::ifstream file;
+	std::istream* input = &std::cin;
+	if (path != "-") {
+		file.open(path);
+		if (!file) {
+			std::cerr << "evalbatch failed to open " << path << "\n";
+			return 1;
+		}
+		input = &file;
+	}
+
+	std::vector<Position> positions;
+	std::vector<bool> valid;
+	std::vector<int> scores;
+	std::string line;
+	std::string output;
+	std::uint64_t total = 0;
+	auto start = std::chrono::steady_clock::now();
+	bool more = true;
+	while (more) {
+		positions.clear();
+		valid.clear();
+		while (valid.size() < kChunkLines) {
+			if (!std::getline(*input, line)) {
+				more = false;
+				break;
+			}
+			positions.emplace_back();
+			bool parsed = LoadFen(positions.back(), line);
+			if (!parsed) {
+				positions.pop_back();
+			}
+			valid.push_back(parsed);
+		}
+		scores.resize(positions.size());
+		EvaluateBatch(positions, scores, threads, network.IsLoaded() ? &network : nullptr);
+		output.clear();
+		std::size_t next = 0;
+		for (bool parsed : valid) {
+			output.append(parsed ? std::to_string(scores[next++]) : "none");
+			output.push_back('\n');
+		}
+		std::cout.write(output.data(), static_cast<std::streamsize>(output.size()));
+		total += positions.size();
+	}
+	std::cout.flush();
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start);
+	std::uint64_t per_second = elapsed.count() == 0 ? 0 : total * 1000 / elapsed.count();
+	std::cerr << "evalbatch positions " << total << " time_ms " << elapsed.count()
+		<< " positions_per_second " << per_second << "\n";
 	return 0;
 }
 
+int RunMateBatch(const std::string& path, int max_moves, int threads) {
+	constexpr std::size_t kMateTableMegabytes = 64;
+
+	std::ifstream file;
+	std::istream* input = &std::cin;
+	if (path != "-") {
+		file.open(path);
+		if (!file) {
+			std::cerr << "matebatch failed to open " << path << "\n";
+			return 1;
+		}
+		input = &file;
+	}
+	MateSolver solver(kMateTableMegabytes);
+	MateSolverLimits limits;
+	limits.threads = threads;
+	std::uint64_t total = 0;
+	std::uint64_t solved = 0;
+	std::uint64_t mismatched = 0;
+	std::uint64_t total_nodes = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::string line;
+	while (std::getline(*input, line)) {
+		std::vector<std::string> tokens = SplitTokens(line);
+		if (tokens.size() < 4) {
+			continue;
+		}
+		++total;
+		// EPD: four FEN fields, then operations such as dm 3; and id "name";
+		std::string name = std::to_string(total);
+		int expected = 0;
+		for (std::size_t index = 4; index + 1 < tokens.size(); ++index) {
+			std::string operand = tokens[index + 1];
+			if (!operand.empty() && operand.back() == ';') {
+				operand.pop_back();
+			}
+			if (tokens[index] == "dm") {
+				ParseInt(operand, expected);
+			} else if (tokens[index] == "id") {
+				name = operand;
+				std::erase(name, '"');
+			}
+		}
+		Position position;
+		if (!LoadFen(position, JoinTokens({tokens.begin(), tokens.begin() + 4}, 0))) {
+			std::cout << name << " invalid\n";
+			continue;
+		}
+		auto position_start = std::chrono::steady_clock::now();
+		MateSolution solution =
+			solver.Solve(position, expected > 0 ? expected : max_moves, limits);
+		auto position_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - position_start).count();
+		total_nodes += solution.nodes;
+		std::ostringstream output;
+		output << name;
+		if (solution.found) {
+			++solved;
+			output << " mate " << solution.moves << " pv";
+			for (Move move : solution.pv) {
+				output << " " << MoveToUci(move);
+			}
+		} else {
+			// Unknown when the limits or the proof numbers ran out before a disproof.
+			output << (solution.disproved ? " none" : " unknown");
+		}
+		if (expected > 0 && (!solution.found || solution.moves != expected)) {
+			++mismatched;
+			output << " expected " << expected;
+		}
+		output << " nodes " << solution.nodes << " time_ms " << position_ms << "\n";
+		std::cout << output.str() << std::flush;
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start);
+	std::cerr << "matebatch positions " << total << " solved " << solved << " mismatched "
+		<< mismatched << " nodes " << total_nodes << " time_ms " << elapsed.count() << "\n";
+	return mismatched == 0 ? 0 : 2;
+}
+
 }
+
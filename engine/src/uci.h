@@ -1,9 +1,16 @@
 #pragma once
 
+#include <string>
+
 namespace flare {
 
 int RunUciLoop();
 int RunBench(int depth, int threads);
+// Streams FENs, one per line, from path ("-" for stdin) and prints one score per line.
+int RunEvalBatch(const std::string& path, int threads, const std::string& network_path);
+// Solves EPD positions, one per line, from path ("-" for stdin) with the proof-number mate
+// solver, up to each position's dm operation or max_moves, and prints the mate found.
+int RunMateBatch(const std::string& path, int max_moves, int threads);
 
 }
 
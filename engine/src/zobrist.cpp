@@ -28,6 +28,11 @@ Zobrist::Zobrist() {
 		entry = NextRandom(state);
 	}
 	side_to_move_ = NextRandom(state);
+	for (auto& piece_entries : material_) {
+		for (auto& entry : piece_entries) {
+			entry = NextRandom(state);
+		}
+	}
 }
 
 const Zobrist& Zobrist::Instance() {
@@ -52,4 +57,9 @@ std::uint64_t Zobrist::SideToMove() const {
 	return side_to_move_;
 }
 
+const std::array<std::array<std::uint64_t, kSquareCount>, kPieceCount>&
+Zobrist::Material() const {
+	return material_;
+}
+
 }
@@ -15,6 +15,8 @@ public:
 	const std::array<std::uint64_t, 16>& Castling() const;
 	const std::array<std::uint64_t, kFileCount>& EnPassant() const;
 	std::uint64_t SideToMove() const;
+	// Indexed by piece and the number of that piece already on the board.
+	const std::array<std::array<std::uint64_t, kSquareCount>, kPieceCount>& Material() const;
 
 private:
 	Zobrist();
@@ -23,6 +25,7 @@ private:
 	std::array<std::uint64_t, 16> castling_{};
 	std::array<std::uint64_t, kFileCount> en_passant_{};
 	std::uint64_t side_to_move_ = 0;
+	std::array<std::array<std::uint64_t, kSquareCount>, kPieceCount> material_{};
 };
 
 }
@@ -1,17 +1,35 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
+#include "attack.h"
+#include "bitboard.h"
+#include "endgame.h"
+#include "eval.h"
 #include "fen.h"
+#include "mate_solver.h"
 #include "movegen.h"
+#include "nnue.h"
 #include "perft.h"
 #include "position.h"
+#include "psqt.h"
+#include "search.h"
+#include "time_manager.h"
+#include "transposition_table.h"
 
 namespace flare {
 
@@ -656,6 +674,848 @@ void TestPromotionMoves() {
 	ExpectEqual(promotion_moves, 4, "promotion move count");
 }
 
+void TestTranspositionSnapshot() {
+	namespace fs = std::filesystem;
+	fs::path snapshot = fs::temp_directory_path() / "flare_tt_snapshot.bin";
+	fs::path mapped = fs::temp_directory_path() / "flare_tt_mapped.bin";
+	fs::remove(snapshot);
+	fs::remove(mapped);
+
+	Position position;
+	position.SetStartPosition();
+	std::vector<Move> moves;
+	GenerateLegalMoves(position, moves);
+	Move best_move = moves.empty() ? kNoMove : moves.front();
+
+	TranspositionTable table;
+	table.Store(position.hash_, 7, 42, Bound::kLower, best_move, 13);
+	Expect(table.Save(snapshot.string()), "tt snapshot save");
+
+	TranspositionTable restored;
+	Expect(restored.Load(snapshot.string()), "tt snapshot load");
+	TranspositionEntry entry;
+	Expect(restored.Probe(position.hash_, entry), "tt snapshot probe after load");
+	Expect(entry.best_move == best_move && entry.depth == 7 && entry.score == 42 &&
+		entry.static_eval == 13 && entry.bound == Bound::kLower, "tt snapshot entry contents");
+
+	{
+		std::fstream corrupt(snapshot, std::ios::in | std::ios::out | std::ios::binary);
+		corrupt.seekp(-1, std::ios::end);
+		corrupt.put('\x5a');
+	}
+	TranspositionTable rejected;
+	Expect(!rejected.Load(snapshot.string()), "tt snapshot checksum rejects corruption");
+	Expect(!rejected.Probe(position.hash_, entry), "tt snapshot rejected load leaves table empty");
+	Expect(!restored.Load(snapshot.string()), "tt snapshot rejects corruption over a warm table");
+	Expect(restored.Probe(position.hash_, entry) && entry.depth == 7,
+		"tt snapshot rejected load keeps the warm table");
+
+	{
+		TranspositionTable mapped_table;
+		Expect(mapped_table.MapFile(mapped.string()), "tt map file");
+		mapped_table.Store(position.hash_, 5, -17, Bound::kUpper, best_move, kNoStaticEval);
+	}
+	TranspositionTable remapped;
+	Expect(remapped.MapFile(mapped.string()), "tt remap file");
+	Expect(remapped.Probe(position.hash_, entry) && entry.depth == 5 && entry.score == -17 &&
+		entry.static_eval == kNoStaticEval, "tt mapped file keeps entries across instances");
+	Expect(remapped.MapFile(""), "tt unmap file");
+	Expect(remapped.Probe(position.hash_, entry), "tt unmapped table keeps warm entries");
+
+	// Files that are not a table of this size are refused, never truncated or overwritten.
+	{
+		std::ofstream(mapped, std::ios::binary | std::ios::trunc) << "not a hash table";
+	}
+	Expect(!remapped.MapFile(mapped.string()), "tt map refuses a file of another size");
+	ExpectEqual(fs::file_size(mapped), 16, "tt refused file keeps its size");
+	fs::resize_file(mapped, fs::file_size(snapshot));
+	Expect(!remapped.MapFile(mapped.string()), "tt map refuses a file without a table header");
+	{
+		std::ifstream input(mapped, std::ios::binary);
+		std::string contents(16, '\0');
+		input.read(contents.data(), 16);
+		Expect(contents == "not a hash table", "tt refused file keeps its contents");
+	}
+	Expect(remapped.Probe(position.hash_, entry), "tt refused map keeps warm entries");
+
+	fs::remove(snapshot);
+	fs::remove(mapped);
+}
+
+void TestSharedTranspositionTable() {
+	std::string segment = "/flare_tt_test_" + std::to_string(::getpid());
+	::shm_unlink(segment.c_str());
+
+	Position position;
+	position.SetStartPosition();
+	{
+		TranspositionTable first;
+		TranspositionTable second;
+		Expect(first.MapShared(segment), "shared tt create");
+		Expect(second.MapShared(segment), "shared tt attach");
+		Expect(first.IsShared() && second.IsShared(), "shared tt storage mode");
+
+		first.Store(position.hash_, 6, 25, Bound::kExact, kNoMove, kNoStaticEval);
+		TranspositionEntry entry;
+		Expect(second.Probe(position.hash_, entry) && entry.depth == 6 && entry.score == 25,
+			"shared tt entry visible to other attachment");
+
+		second.NewGame();
+		Expect(first.Probe(position.hash_, entry), "shared tt new game keeps entries");
+
+		first.NewSearch();
+		for (std::uint64_t key = 0; key < 1000; ++key) {
+			first.Store(key, 1, 0, Bound::kExact, kNoMove, kNoStaticEval);
+		}
+		second.NewSearch();
+		ExpectEqual(second.Hashfull(), 1000,
+			"shared tt searches started together share a generation");
+
+		Expect(first.MapShared(""), "shared tt detach");
+		Expect(!first.IsShared() && first.Probe(position.hash_, entry),
+			"shared tt detach keeps warm copy");
+		int fd = ::shm_open(segment.c_str(), O_RDWR, 0600);
+		Expect(fd >= 0, "shared tt segment stays while a process is attached");
+		if (fd >= 0) {
+			::close(fd);
+		}
+	}
+	int fd = ::shm_open(segment.c_str(), O_RDWR, 0600);
+	Expect(fd < 0, "shared tt segment is removed when the last process detaches");
+	if (fd >= 0) {
+		::close(fd);
+	}
+	::shm_unlink(segment.c_str());
+}
+
+void TestTranspositionStats() {
+	Position position;
+	position.SetStartPosition();
+	TranspositionTable table;
+	table.NewSearch();
+	ExpectEqual(table.Hashfull(), 0, "tt hashfull empty");
+
+	TranspositionStats stats;
+	TranspositionEntry entry;
+	Expect(!table.Probe(position.hash_, entry, &stats), "tt stats probe miss");
+	table.Store(position.hash_, 3, 10, Bound::kExact, kNoMove, kNoStaticEval, &stats);
+	Expect(table.Probe(position.hash_, entry, &stats), "tt stats probe hit");
+	std::uint64_t colliding_key = position.hash_ ^ (std::uint64_t{1} << 63);
+	table.Store(colliding_key, 3, 10, Bound::kExact, kNoMove, kNoStaticEval, &stats);
+	ExpectEqual(stats.probes, 2, "tt stats probes");
+	ExpectEqual(stats.hits, 1, "tt stats hits");
+	ExpectEqual(stats.stores, 2, "tt stats stores");
+	ExpectEqual(stats.replacements, 1, "tt stats replacements");
+
+	for (std::uint64_t key = 0; key < 1000; ++key) {
+		table.Store(key, 1, 0, Bound::kExact, kNoMove, kNoStaticEval);
+	}
+	ExpectEqual(table.Hashfull(), 1000, "tt hashfull after filling sample");
+	table.NewSearch();
+	ExpectEqual(table.Hashfull(), 0, "tt hashfull ignores older generations");
+
+	table.Store(position.hash_, 4, 30, Bound::kExact, kNoMove, 21);
+	table.SetEvaluator(0x1234);
+	Expect(table.Probe(position.hash_, entry) && entry.score == 30 &&
+		entry.static_eval == kNoStaticEval, "tt drops static evals from another evaluator");
+	table.Store(position.hash_, 4, 30, Bound::kExact, kNoMove, 22);
+	Expect(table.Probe(position.hash_, entry) && entry.static_eval == 22,
+		"tt keeps static evals from the same evaluator");
+	table.SetEvaluator(0);
+	Expect(table.Probe(position.hash_, entry) && entry.static_eval == kNoStaticEval,
+		"tt drops network evals under the classical evaluator");
+}
+
+void CheckIncrementalTree(Position& position, int depth, EvalContext& context, int& mismatches) {
+	std::uint64_t incremental = position.pawn_hash_;
+	position.ComputePawnHash();
+	if (position.pawn_hash_ != incremental) {
+		++mismatches;
+	}
+	if (position.psq_ != ComputePsqScore(position) || position.phase_ != ComputePhase(position)) {
+		++mismatches;
+	}
+	incremental = position.material_key_;
+	position.ComputeMaterialKey();
+	if (position.material_key_ != incremental) {
+		++mismatches;
+	}
+	if (Evaluate(position) != Evaluate(position, context)) {
+		++mismatches;
+	}
+	if (depth == 0) {
+		return;
+	}
+	std::vector<Move> moves;
+	GenerateLegalMoves(position, moves);
+	for (Move move : moves) {
+		MoveState state;
+		MakeMove(position, move, state);
+		CheckIncrementalTree(position, depth - 1, context, mismatches);
+		UndoMove(position, move, state);
+	}
+}
+
+void TestPawnHash() {
+	EvalContext context;
+	for (std::string_view fen : {
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		"4k3/1P6/8/3pP3/8/8/6p1/4K3 w - d6 0 1",
+	}) {
+		Position position;
+		Expect(LoadFen(position, fen), "pawn hash fen parse");
+		int mismatches = 0;
+		CheckIncrementalTree(position, 2, context, mismatches);
+		ExpectEqual(mismatches, 0, "incremental keys, psq and cached pawn eval match recomputation");
+	}
+	Expect(context.pawn_table.Hits() * 10 > context.pawn_table.Probes() * 9,
+		"pawn table hit rate above 90 percent");
+
+	Position isolated;
+	Position supported;
+	Expect(LoadFen(isolated, "4k3/8/8/8/8/8/P1P5/4K3 w - - 0 1"), "isolated pawn fen parse");
+	Expect(LoadFen(supported, "4k3/8/8/8/8/8/PP6/4K3 w - - 0 1"), "supported pawn fen parse");
+	Expect(Evaluate(supported) > Evaluate(isolated), "isolated pawns are penalised");
+}
+
+// Compares the lazily updated accumulators against a refresh from scratch with every kernel
+// the host supports.
+void CheckNnueTree(Position& position, int depth, nnue::Network& network,
+	nnue::AccumulatorStack& stack, int& mismatches) {
+	int incremental = stack.Evaluate(position, network);
+	nnue::Kernel best = network.ActiveKernel();
+	for (nnue::Kernel kernel : {nnue::Kernel::kScalar, nnue::Kernel::kSse41,
+		nnue::Kernel::kAvx2}) {
+		if (!network.SetKernel(kernel)) {
+			continue;
+		}
+		nnue::AccumulatorStack fresh;
+		if (fresh.Evaluate(position, network) != incremental) {
+			++mismatches;
+		}
+	}
+	network.SetKernel(best);
+	if (depth == 0) {
+		return;
+	}
+	std::vector<Move> moves;
+	GenerateLegalMoves(position, moves);
+	for (Move move : moves) {
+		MoveState state;
+		stack.Push(position, move);
+		MakeMove(position, move, state);
+		CheckNnueTree(position, depth - 1, network, stack, mismatches);
+		UndoMove(position, move, state);
+		stack.Pop();
+	}
+}
+
+void TestNnue() {
+	namespace fs = std::filesystem;
+	fs::path path = fs::temp_directory_path() / "flare_test.nnue";
+	fs::remove(path);
+
+	nnue::Network generated;
+	generated.Randomize(2024);
+	Expect(generated.Save(path.string()), "nnue save");
+	nnue::Network network;
+	Expect(!network.IsLoaded(), "nnue starts unloaded");
+	Expect(network.Load(path.string()), "nnue load");
+	nnue::Network other;
+	other.Randomize(2025);
+	Expect(network.Fingerprint() == generated.Fingerprint() &&
+		network.Fingerprint() != other.Fingerprint() && network.Fingerprint() != 0,
+		"nnue fingerprint identifies the parameters");
+
+	for (std::string_view fen : {
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"r3k2r/1P6/8/3pP3/8/8/6p1/R3K2R w KQkq d6 0 1",
+	}) {
+		Position position;
+		Expect(LoadFen(position, fen), "nnue fen parse");
+		nnue::AccumulatorStack stack;
+		int mismatches = 0;
+		CheckNnueTree(position, 2, network, stack, mismatches);
+		ExpectEqual(mismatches, 0, "nnue incremental and simd evals match scalar refresh");
+	}
+
+	Position start;
+	start.SetStartPosition();
+	nnue::AccumulatorStack stack;
+	ExpectEqual(stack.Evaluate(start, network), stack.Evaluate(start, generated),
+		"mapped and generated networks agree");
+
+	{
+		std::fstream corrupt(path, std::ios::in | std::ios::out | std::ios::binary);
+		corrupt.seekp(8);
+		corrupt.put(static_cast<char>(0x7F));
+	}
+	nnue::Network rejected;
+	Expect(!rejected.Load(path.string()), "nnue rejects unknown version");
+	fs::remove(path);
+}
+
+void CollectPositions(Position& position, int depth, std::vector<Position>& positions) {
+	positions.push_back(position);
+	if (depth == 0) {
+		return;
+	}
+	std::vector<Move> moves;
+	GenerateLegalMoves(position, moves);
+	for (Move move : moves) {
+		MoveState state;
+		MakeMove(position, move, state);
+		CollectPositions(position, depth - 1, positions);
+		UndoMove(position, move, state);
+	}
+}
+
+void TestEvaluateBatch() {
+	Position root;
+	Expect(LoadFen(root, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"),
+		"batch fen parse");
+	std::vector<Position> positions;
+	// Large enough for the batch to be split across worker threads.
+	while (positions.size() < 20000) {
+		CollectPositions(root, 2, positions);
+	}
+	std::vector<int> expected;
+	for (const Position& position : positions) {
+		expected.push_back(Evaluate(position));
+	}
+	for (int threads : {1, 4}) {
+		std::vector<int> scores(positions.size());
+		EvaluateBatch(positions, scores, threads);
+		Expect(scores == expected, "batch evaluation matches single evaluation");
+	}
+
+	nnue::Network network;
+	network.Randomize(99);
+	std::vector<int> scores(positions.size());
+	EvaluateBatch(positions, scores, 2, &network);
+	int mismatches = 0;
+	for (std::size_t i = 0; i < positions.size(); i += 97) {
+		nnue::AccumulatorStack stack;
+		if (stack.Evaluate(positions[i], network) != scores[i]) {
+			++mismatches;
+		}
+	}
+	ExpectEqual(mismatches, 0, "batch network evaluation matches single evaluation");
+}
+
+void TestAttackInfo() {
+	Position root;
+	Expect(LoadFen(root, "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"),
+		"attack info fen parse");
+	std::vector<Position> positions;
+	CollectPositions(root, 2, positions);
+	int mismatches = 0;
+	for (const Position& position : positions) {
+		AttackInfo info;
+		ComputeAttackInfo(position, info);
+		for (Color color : {Color::kWhite, Color::kBlack}) {
+			int index = ToIndex(color);
+			if ((info.double_attacked[index] & ~info.attacked[index]) != 0 ||
+				(info.attacked[index] & ~info.king_danger[ToIndex(OppositeColor(color))]) != 0) {
+				++mismatches;
+			}
+			for (int square_index = 0; square_index < kSquareCount; ++square_index) {
+				Square square = static_cast<Square>(square_index);
+				if (HasBit(info.attacked[index], square) !=
+					IsSquareAttacked(position, square, color)) {
+					++mismatches;
+				}
+			}
+		}
+	}
+	ExpectEqual(mismatches, 0, "attack maps agree with square attack queries");
+}
+
+void TestLazyEval() {
+	Position position;
+	Expect(LoadFen(position, "4k3/4p3/8/8/8/8/8/QQ2K3 w - - 0 1"), "lazy eval fen parse");
+	EvalContext context;
+	int score = 0;
+	Expect(TryLazyEvaluate(position, context, -100, 100, score) && score > 100 + kLazyEvalMargin,
+		"lazy tier settles a position far above beta");
+	Expect(!TryLazyEvaluate(position, context, score - 50, score + 50, score),
+		"lazy tier defers inside the window");
+	ExpectEqual(context.stats.lazy, 1, "lazy tier is counted");
+	Evaluate(position, context);
+	ExpectEqual(context.stats.full, 1, "full tier is counted");
+}
+
+void TestEvalCache() {
+	Position position;
+	position.SetStartPosition();
+	EvalContext context;
+	int expected = Evaluate(position);
+	ExpectEqual(Evaluate(position, context), expected, "eval cache miss computes the full score");
+	ExpectEqual(Evaluate(position, context), expected, "eval cache hit returns the stored score");
+	ExpectEqual(context.stats.full, 1, "eval cache hit skips the full tier");
+	ExpectEqual(context.stats.cache_hits, 1, "eval cache hit is counted");
+
+	int score = 0;
+	Position other;
+	Expect(LoadFen(other, "4k3/4p3/8/8/8/8/8/QQ2K3 w - - 0 1"), "eval cache fen parse");
+	TryLazyEvaluate(other, context, -100, 100, score);
+	Expect(!ProbeEvalCache(other, context, score), "lazy scores are not cached");
+	ExpectEqual(context.stats.cache_probes, 3, "eval cache probes are counted");
+
+	std::vector<EvalContext> contexts;
+	SearchLimits limits;
+	limits.max_depth = 3;
+	limits.eval_contexts = &contexts;
+	TranspositionTable first_table;
+	SearchResult first = Search(position, limits, first_table);
+	ExpectEqual(contexts.size(), 1, "search sizes the caller's eval contexts");
+	TranspositionTable second_table;
+	SearchResult second = Search(position, limits, second_table);
+	Expect(second.eval_stats.cache_hits > first.eval_stats.cache_hits &&
+		second.eval_stats.cache_probes == first.eval_stats.cache_probes,
+		"eval caches carry over between searches and stats restart");
+}
+
+int EvaluateFen(std::string_view fen) {
+	Position position;
+	Expect(LoadFen(position, fen), "endgame fen parse");
+	return Evaluate(position);
+}
+
+void TestEndgames() {
+	Position position;
+	Expect(LoadFen(position, "8/8/8/4k3/8/8/8/1B2K1N1 w - - 0 1"), "material key fen parse");
+	ExpectEqual(position.material_key_, MaterialKey("KBNK", Color::kWhite),
+		"material key matches its signature");
+	Expect(position.material_key_ != MaterialKey("KBNK", Color::kBlack),
+		"material key tells the sides apart");
+
+	const Endgames& endgames = Endgames::Instance();
+	Expect(endgames.ProbeKpk(Color::kWhite, Square::kE6, Square::kE5, Square::kE8, Color::kBlack),
+		"kpk king on the sixth wins");
+	Expect(!endgames.ProbeKpk(Color::kWhite, Square::kB1, Square::kA2, Square::kA8, Color::kWhite),
+		"kpk rook pawn with the king in the corner draws");
+	Expect(endgames.ProbeKpk(Color::kBlack, Square::kD3, Square::kD4, Square::kD1, Color::kWhite),
+		"kpk is colour symmetric");
+
+	Expect(EvaluateFen("4k3/8/4K3/4P3/8/8/8/8 b - - 0 1") < -kKnownWin, "kpk win is known");
+	ExpectEqual(EvaluateFen("k7/8/8/8/8/8/P7/K7 w - - 0 1"), 0, "kpk draw evaluates to zero");
+	ExpectEqual(EvaluateFen("4k3/8/8/8/8/8/8/2N1K3 w - - 0 1"), 0, "lone knight is a draw");
+	Expect(EvaluateFen("7k/8/8/8/8/8/8/R3K3 w - - 0 1") >
+		EvaluateFen("8/8/8/4k3/8/8/8/R3K3 w - - 0 1"), "kxk drives the king to the edge");
+	Expect(EvaluateFen("k7/8/2K5/8/8/8/8/1B4N1 w - - 0 1") >
+		EvaluateFen("7k/8/5K2/8/8/8/8/1B4N1 w - - 0 1"), "kbnk prefers the bishop's corner");
+	Expect(EvaluateFen("4k3/5p2/8/3b4/8/4B3/4PP2/4K3 w - - 0 1") <
+		EvaluateFen("4k3/5p2/8/4b3/8/4B3/4PP2/4K3 w - - 0 1"), "opposite bishops scale down");
+}
+
+Move FindUciMove(Position& position, std::string_view uci) {
+	std::vector<Move> moves;
+	GenerateLegalMoves(position, moves);
+	for (Move move : moves) {
+		if (MoveToUci(move) == uci) {
+			return move;
+		}
+	}
+	return kNoMove;
+}
+
+void TestTimeManager() {
+	TimeBudget budget = AllocateTime(60000, 0, 0);
+	ExpectEqual(budget.optimum_ms, 1800, "time optimum splits the clock over 30 moves");
+	ExpectEqual(budget.maximum_ms, 7200, "time maximum is a multiple of the optimum");
+	budget = AllocateTime(900, 0, 1);
+	Expect(budget.optimum_ms <= budget.maximum_ms && budget.maximum_ms <= 890,
+		"last move before the control keeps the move overhead");
+	ExpectEqual(AllocateTime(0, 1000, 0).maximum_ms, 0, "no clock left gives no budget");
+
+	Move first = EncodeMove(Square::kE2, Square::kE4, PieceType::kPawn,
+		PieceType::kNone, PieceType::kNone, MoveFlag::kNone);
+	Move second = EncodeMove(Square::kD2, Square::kD4, PieceType::kPawn,
+		PieceType::kNone, PieceType::kNone, MoveFlag::kNone);
+	TimeManager stable(1000, 4000);
+	for (int iteration = 0; iteration < 5; ++iteration) {
+		stable.CompleteIteration(first, 20);
+	}
+	Expect(stable.SoftLimitMs() < 1000, "stable best move shrinks the soft limit");
+	TimeManager unstable(1000, 4000);
+	unstable.CompleteIteration(first, 20);
+	unstable.CompleteIteration(second, 20);
+	Expect(unstable.SoftLimitMs() > 1000, "best move change extends the soft limit");
+	TimeManager dropping(1000, 4000);
+	dropping.CompleteIteration(first, 20);
+	dropping.CompleteIteration(first, -80);
+	Expect(dropping.SoftLimitMs() > 1000, "score drop extends the soft limit");
+	TimeManager clear(1000, 4000);
+	clear.CompleteIteration(first, 20, 950);
+	TimeManager contested(1000, 4000);
+	contested.CompleteIteration(first, 20, 300);
+	Expect(clear.SoftLimitMs() < 1000 && contested.SoftLimitMs() > 1000,
+		"best move node share scales the soft limit");
+	TimeManager fixed(0, 500);
+	fixed.CompleteIteration(first, 20);
+	fixed.CompleteIteration(first, 20);
+	ExpectEqual(fixed.SoftLimitMs(), 500, "movetime keeps the whole budget");
+	Expect(TimeManager(0, 0).ShouldStartIteration(), "no clock never stops iterating");
+	// Iterations of 4 and 40 ms predict one of 400 ms: too long for a 200 ms deadline, short
+	// enough for a 2000 ms one.
+	TimeManager tight(0, 200);
+	TimeManager loose(0, 2000);
+	for (int milliseconds : {4, 40}) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+		tight.CompleteIteration(first, 20);
+		loose.CompleteIteration(first, 20);
+	}
+	Expect(!tight.ShouldStartIteration() && loose.ShouldStartIteration(),
+		"next iteration is predicted from the growth of the last two");
+
+	std::atomic<bool> pondering{true};
+	TimeManager ponder(0, 1, &pondering);
+	Expect(ponder.Deadline() == std::chrono::steady_clock::time_point::max(),
+		"pondering has no deadline");
+	std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	Expect(ponder.ShouldStartIteration(), "pondering keeps iterating past the maximum");
+	pondering.store(false);
+	ponder.Poll();
+	Expect(!ponder.Pondering() && ponder.Deadline() > std::chrono::steady_clock::now() -
+		std::chrono::milliseconds(1), "ponderhit starts the clock");
+
+	TranspositionTable table;
+	Position start;
+	start.SetStartPosition();
+	SearchResult result = Search(start, 3, table);
+	MoveState state;
+	MakeMove(start, result.best_move, state);
+	Expect(FindUciMove(start, MoveToUci(result.ponder_move)) == result.ponder_move &&
+		result.ponder_move != kNoMove, "search predicts a legal reply to ponder on");
+}
+
+void TestMultiPv() {
+	Position position;
+	Expect(LoadFen(position, "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3"),
+		"multipv fen parse");
+	TranspositionTable table;
+	SearchLimits limits;
+	limits.max_depth = 3;
+	limits.multipv = 3;
+	int iterations = 0;
+	limits.on_iteration = [&iterations](const SearchResult&) {
+		++iterations;
+	};
+	SearchResult result = Search(position, limits, table);
+	ExpectEqual(iterations, 3, "multipv reports every iteration");
+	ExpectEqual(result.lines.size(), 3, "multipv returns one line per requested move");
+	Expect(!result.lines[0].pv.empty() && result.lines[0].pv[0] == result.best_move,
+		"first multipv line is the best move");
+	bool distinct = true;
+	bool ordered = true;
+	for (std::size_t index = 1; index < result.lines.size(); ++index) {
+		distinct = distinct && result.lines[index].pv[0] != result.lines[index - 1].pv[0] &&
+			result.lines[index].pv[0] != result.lines[0].pv[0];
+		ordered = ordered && result.lines[index].score <= result.lines[index - 1].score;
+	}
+	Expect(distinct, "multipv lines start with different moves");
+	Expect(ordered, "multipv lines are ordered by score");
+
+	// The table is now full of deeper lines, which a shallow search must not print.
+	SearchLimits shallow;
+	shallow.max_depth = 1;
+	shallow.multipv = 3;
+	result = Search(position, shallow, table);
+	bool bounded = !result.lines.empty();
+	for (const PvLine& line : result.lines) {
+		bounded = bounded && line.pv.size() == 1;
+	}
+	Expect(bounded, "multipv lines are no longer than the depth searched");
+
+	Position cornered;
+	Expect(LoadFen(cornered, "7k/8/8/8/8/8/8/K5q1 w - - 0 1"), "multipv fen parse");
+	limits.multipv = 5;
+	result = Search(cornered, limits, table);
+	Expect(!result.lines.empty() && result.lines.size() == 2,
+		"multipv stops when the root moves run out");
+
+	Position start;
+	start.SetStartPosition();
+	SearchLimits restricted;
+	restricted.max_depth = 3;
+	restricted.multipv = 3;
+	restricted.search_moves = {FindUciMove(start, "a2a3"), FindUciMove(start, "h2h4")};
+	for (int threads : {1, 2}) {
+		result = Search(start, restricted, table, threads);
+		ExpectEqual(result.lines.size(), 2, "searchmoves limits the multipv lines");
+		Expect(result.best_move == restricted.search_moves[0] ||
+			result.best_move == restricted.search_moves[1], "searchmoves restricts the best move");
+	}
+}
+
+void TestNodeAndMateLimits() {
+	Position start;
+	start.SetStartPosition();
+	SearchLimits budget;
+	budget.nodes = 3000;
+	TranspositionTable first_table;
+	TranspositionTable second_table;
+	SearchResult first = Search(start, budget, first_table);
+	SearchResult second = Search(start, budget, second_table);
+	Expect(first.best_move != kNoMove, "node limited search returns a move");
+	Expect(first.best_move == second.best_move && first.score == second.score &&
+		first.depth == second.depth, "node limited search is deterministic");
+	Expect(first.nodes <= budget.nodes, "node limited search keeps to the budget");
+	for (int threads : {1, 2}) {
+		TranspositionTable table;
+		SearchLimits exact;
+		exact.nodes = 5000;
+		SearchResult result = Search(start, exact, table, threads);
+		Expect(result.best_move != kNoMove && result.nodes <= exact.nodes,
+			"node limit holds whatever the thread count");
+	}
+
+	// Even a budget spent before the first move is finished leaves a move to play. The
+	// caller's stop waits for the first iteration, so it leaves a real score as well.
+	budget.nodes = 1;
+	TranspositionTable tiny_table;
+	SearchResult tiny = Search(start, budget, tiny_table);
+	Expect(tiny.best_move != kNoMove && tiny.nodes <= 1, "a one node budget still gives a move");
+	std::atomic<bool> stopped{true};
+	SearchLimits stopped_limits;
+	stopped_limits.infinite = true;
+	stopped_limits.stop = &stopped;
+	tiny = Search(start, stopped_limits, tiny_table);
+	Expect(tiny.best_move != kNoMove && IsSearchScore(tiny.score),
+		"a search stopped before it starts still returns a move");
+	Expect(stopped.load(), "search leaves the caller's stop flag alone");
+	std::atomic<bool> running{false};
+	SearchLimits timed;
+	timed.time_ms = 50;
+	timed.stop = &running;
+	tiny = Search(start, timed, tiny_table);
+	Expect(tiny.best_move != kNoMove && !running.load(),
+		"a timed search does not raise the caller's stop flag");
+
+	Expect(MateInMoves(30000 - 3) == 2, "mate score converts to moves");
+	Expect(MateInMoves(-30000 + 4) == -2, "mated score converts to negative moves");
+	Expect(MateInMoves(150) == 0, "ordinary score has no mate");
+
+	Position back_rank;
+	Expect(LoadFen(back_rank, "r5k1/5ppp/8/8/8/8/3R1PPP/3R2K1 w - - 0 1"), "mate fen parse");
+	TranspositionTable table;
+	SearchLimits mate;
+	mate.mate = 2;
+	SearchResult result = Search(back_rank, mate, table);
+	Expect(result.best_move == FindUciMove(back_rank, "d2d8"), "go mate finds the mating move");
+	ExpectEqual(MateInMoves(result.score), 2, "go mate reports the mate length");
+	ExpectEqual(result.lines.size() == 1 ? result.lines[0].pv.size() : 0, 3,
+		"go mate returns the whole mating line");
+	mate.mate = 1;
+	result = Search(back_rank, mate, table);
+	Expect(result.best_move != kNoMove && MateInMoves(result.score) != 1,
+		"go mate falls back to a normal search without a mate in range");
+
+	// The prover follows quiet moves that leave the defender almost no reply.
+	Position quiet;
+	Expect(LoadFen(quiet, "k7/8/2K5/8/8/8/8/7R w - - 0 1"), "mate fen parse");
+	mate.mate = 2;
+	result = Search(quiet, mate, table);
+	ExpectEqual(MateInMoves(result.score), 2, "go mate finds a mate behind a quiet move");
+}
+
+void TestMateSolver() {
+	MateSolver solver(1);
+	MateSolverLimits limits;
+	Position back_rank;
+	Expect(LoadFen(back_rank, "r5k1/5ppp/8/8/8/8/3R1PPP/3R2K1 w - - 0 1"), "solver fen parse");
+	MateSolution solution = solver.Solve(back_rank, 3, limits);
+	Expect(solution.found && solution.moves == 2, "solver proves the back rank mate");
+	Expect(solution.pv.size() == 3 && solution.pv[0] == FindUciMove(back_rank, "d2d8"),
+		"solver returns the mating line");
+
+	// The line must end in mate with every defence taken into account.
+	Position queen;
+	Expect(LoadFen(queen, "8/8/8/8/8/2k5/8/KQ6 w - - 0 1"), "solver fen parse");
+	solution = solver.Solve(queen, 8, limits);
+	Expect(solution.found && solution.moves <= 8 &&
+		solution.pv.size() == static_cast<std::size_t>(2 * solution.moves - 1),
+		"solver proves the queen mate");
+	Position end = queen;
+	for (Move move : solution.pv) {
+		MoveState state;
+		MakeMove(end, move, state);
+	}
+	std::vector<Move> replies;
+	GenerateLegalMoves(end, replies);
+	Expect(replies.empty() && IsSquareAttacked(end, end.KingSquare(end.side_to_move_),
+		OppositeColor(end.side_to_move_)), "solver line ends in checkmate");
+
+	Position start;
+	start.SetStartPosition();
+	solution = solver.Solve(start, 2, limits);
+	Expect(!solution.found && solution.disproved && !solution.saturated,
+		"solver disproves a mate in the start position");
+
+	// A restricted root is disproved without leaving that verdict under the position's key.
+	solver.Clear();
+	MateSolverLimits restricted;
+	restricted.root_moves = {FindUciMove(back_rank, "h2h3")};
+	solution = solver.Solve(back_rank, 2, restricted);
+	Expect(!solution.found && solution.disproved, "solver disproves a restricted root");
+	solution = solver.Solve(back_rank, 2, limits);
+	Expect(solution.found && solution.moves == 2, "solver still proves the unrestricted root");
+
+	solver.Clear();
+	MateSolverLimits budget;
+	budget.nodes = 100;
+	std::atomic<bool> caller_stop{false};
+	budget.stop = &caller_stop;
+	solution = solver.Solve(queen, 12, budget);
+	Expect(!solution.found && !solution.disproved && solution.nodes <= 101,
+		"solver stops at the node budget");
+	Expect(!caller_stop.load(), "solver budget leaves the caller's stop flag alone");
+
+	solver.Clear();
+	MateSolverLimits threaded;
+	threaded.threads = 2;
+	solution = solver.Solve(back_rank, 3, threaded);
+	Expect(solution.found && solution.moves == 2, "solver proves the mate with helper threads");
+
+	TranspositionTable table;
+	SearchLimits mate;
+	mate.mate = 2;
+	mate.mate_solver = &solver;
+	SearchResult result = Search(back_rank, mate, table);
+	ExpectEqual(MateInMoves(result.score), 2, "go mate reports the solver's mate");
+
+	// Without a mate the solver spends its share and the normal search gets the rest.
+	solver.Clear();
+	mate.mate = 3;
+	mate.nodes = 20000;
+	result = Search(start, mate, table);
+	Expect(result.best_move != kNoMove && result.depth > 1 && result.nodes <= 21000,
+		"go mate nodes leaves budget for the fallback search");
+}
+
+void TestParseUciMove() {
+	const std::vector<std::string_view> fens = {
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/Pp2P3/2N2Q1p/1PPBBPPP/R3K2R b KQkq a3 0 1",
+		"n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1",
+		"8/2p5/3p4/KP5r/1R3pPk/8/4P3/8 b - g3 0 1",
+		"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1",
+	};
+	std::vector<Position> positions;
+	for (std::string_view fen : fens) {
+		positions.emplace_back();
+		Expect(LoadFen(positions.back(), fen), "parse uci move fen parse");
+	}
+	bool round_trips = true;
+	bool rejects_others = true;
+	bool leaves_position = true;
+	bool legality_agrees = true;
+	for (Position& position : positions) {
+		std::vector<Move> legal;
+		GenerateLegalMoves(position, legal);
+		std::unordered_set<std::string> legal_uci;
+		for (Move move : legal) {
+			legal_uci.insert(MoveToUci(move));
+			round_trips = round_trips && ParseUciMove(position, MoveToUci(move)) == move;
+		}
+		std::uint64_t hash = position.hash_;
+		for (std::string_view from : kSquareNames) {
+			for (std::string_view to : kSquareNames) {
+				for (std::string_view suffix : {"", "q", "n", "k", "x"}) {
+					std::string uci = std::string(from) + std::string(to) + std::string(suffix);
+					bool parsed = ParseUciMove(position, uci) != kNoMove;
+					rejects_others = rejects_others && parsed == legal_uci.contains(uci);
+				}
+			}
+		}
+		leaves_position = leaves_position && position.hash_ == hash &&
+			position.history_.empty();
+		// Moves from other positions stand in for stale transposition table moves.
+		for (Position& other : positions) {
+			std::vector<Move> foreign;
+			GenerateLegalMoves(other, foreign);
+			for (Move move : foreign) {
+				bool listed = std::find(legal.begin(), legal.end(), move) != legal.end();
+				legality_agrees = legality_agrees && IsLegal(position, move) == listed;
+			}
+		}
+	}
+	Expect(round_trips, "every legal move parses back to itself");
+	Expect(rejects_others, "only legal moves parse");
+	Expect(leaves_position, "parsing leaves the position untouched");
+	Expect(legality_agrees, "move legality matches the generated moves");
+	Position start;
+	start.SetStartPosition();
+	Expect(ParseUciMove(start, "e2e") == kNoMove && ParseUciMove(start, "e2e4qq") == kNoMove &&
+		ParseUciMove(start, "i2i4") == kNoMove, "malformed moves do not parse");
+}
+
+void TestRepetitionDraws() {
+	Position position;
+	position.SetStartPosition();
+	std::vector<MoveState> states;
+	auto play = [&position, &states](std::string_view uci) {
+		Move move = FindUciMove(position, uci);
+		states.emplace_back();
+		MakeMove(position, move, states.back());
+		return move;
+	};
+	std::vector<Move> played;
+	for (std::string_view uci : {"g1f3", "g8f6", "f3g1", "f6g8"}) {
+		played.push_back(play(uci));
+	}
+	ExpectEqual(position.history_.size(), 4, "every move pushes its key");
+	Expect(position.IsDraw(5), "repetition inside the search is a draw");
+	Expect(!position.IsDraw(0), "a single repetition before the root is not");
+	for (std::string_view uci : {"g1f3", "g8f6", "f3g1", "f6g8"}) {
+		played.push_back(play(uci));
+	}
+	Expect(position.IsDraw(0), "threefold repetition is a draw");
+	for (std::size_t index = played.size(); index-- > 0;) {
+		UndoMove(position, played[index], states[index]);
+	}
+	Expect(position.history_.empty(), "undo pops every key");
+
+	// A pawn move between the occurrences makes the earlier one unreachable.
+	Position pawn;
+	pawn.SetStartPosition();
+	states.clear();
+	std::swap(position, pawn);
+	for (std::string_view uci : {"g1f3", "g8f6", "f3g1", "f6g8", "e2e4", "e7e5"}) {
+		play(uci);
+	}
+	for (std::string_view uci : {"g1f3", "g8f6", "f3g1", "f6g8"}) {
+		play(uci);
+	}
+	Expect(!position.IsDraw(0), "repetitions are not looked for past a pawn move");
+
+	Position fifty;
+	Expect(LoadFen(fifty, "8/8/4k3/8/8/3K4/8/7R w - - 100 80"), "fifty fen parse");
+	Expect(fifty.IsDraw(0), "fifty moves without a capture or pawn move is a draw");
+	Expect(LoadFen(fifty, "8/8/4k3/8/8/3K4/8/7R w - - 99 80"), "fifty fen parse");
+	Expect(!fifty.IsDraw(0), "ninety-nine plies are not yet a draw");
+}
+
+void TestTaperedEval() {
+	ExpectEqual(MidgameValue(MakeScore(-7, 11)), -7, "packed score midgame half");
+	ExpectEqual(EndgameValue(MakeScore(-7, 11)), 11, "packed score endgame half");
+	ExpectEqual(EndgameValue(MakeScore(5, -9) - MakeScore(12, 3)), -12, "packed score subtraction");
+
+	Position start;
+	start.SetStartPosition();
+	ExpectEqual(start.phase_, kMaxPhase, "start position has full phase");
+
+	Position central;
+	Position corner;
+	Expect(LoadFen(central, "8/8/8/4k3/8/3K4/4P3/8 w - - 0 1"), "central king fen parse");
+	Expect(LoadFen(corner, "8/8/8/4k3/8/8/4P3/K7 w - - 0 1"), "corner king fen parse");
+	ExpectEqual(central.phase_, 0, "pawn ending has zero phase");
+	Expect(Evaluate(central) > Evaluate(corner), "endgame king prefers the centre");
+}
+
 void RunTests() {
 	TestStartPositionPerft();
 	TestKiwipetePerft();
@@ -663,6 +1523,23 @@ void RunTests() {
 	TestEnPassantTargetSquare();
 	TestCastlingPerft();
 	TestPromotionMoves();
+	TestTranspositionSnapshot();
+	TestSharedTranspositionTable();
+	TestTranspositionStats();
+	TestPawnHash();
+	TestTaperedEval();
+	TestNnue();
+	TestEvaluateBatch();
+	TestAttackInfo();
+	TestLazyEval();
+	TestEvalCache();
+	TestEndgames();
+	TestTimeManager();
+	TestMultiPv();
+	TestNodeAndMateLimits();
+	TestMateSolver();
+	TestRepetitionDraws();
+	TestParseUciMove();
 	TestJsonTestcases();
 }
 
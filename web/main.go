@@ -236,23 +236,23 @@ type EngineProcess struct {
 	errs   chan error
 }
 
-var errEngineFailure = errors.New("engine failure")
-
 type EnginePool struct {
 	enginePath string
+	options    []string
 	engines    chan *EngineProcess
 }
 
-func NewEnginePool(enginePath string, size int) (*EnginePool, error) {
+func NewEnginePool(enginePath string, options []string, size int) (*EnginePool, error) {
 	if size <= 0 {
 		return nil, errors.New("engine pool size must be positive")
 	}
 	pool := &EnginePool{
 		enginePath: enginePath,
+		options:    options,
 		engines:    make(chan *EngineProcess, size),
 	}
 	for i := 0; i < size; i++ {
-		engine, err := startEngine(enginePath)
+		engine, err := startEngine(enginePath, options)
 		if err != nil {
 			pool.Close()
 			return nil, err
@@ -288,7 +288,7 @@ func (p *EnginePool) Release(engine *EngineProcess, healthy bool) {
 	}
 	if !healthy {
 		engine.Close()
-		if replacement, err := startEngine(p.enginePath); err == nil {
+		if replacement, err := startEngine(p.enginePath, p.options); err == nil {
 			select {
 			case p.engines <- replacement:
 			default:
@@ -301,7 +301,7 @@ func (p *EnginePool) Release(engine *EngineProcess, healthy bool) {
 	}
 	if err := engine.NewGame(); err != nil {
 		engine.Close()
-		if replacement, err := startEngine(p.enginePath); err == nil {
+		if replacement, err := startEngine(p.enginePath, p.options); err == nil {
 			select {
 			case p.engines <- replacement:
 			default:
@@ -329,7 +329,7 @@ func (p *EnginePool) Close() {
 	}
 }
 
-func startEngine(path string) (*EngineProcess, error) {
+func startEngine(path string, options []string) (*EngineProcess, error) {
 	if _, err := os.Stat(path); err != nil {
 		return nil, fmt.Errorf("engine binary not found at %s", path)
 	}
@@ -354,7 +354,7 @@ func startEngine(path string) (*EngineProcess, error) {
 		errs:   make(chan error, 1),
 	}
 	engine.startReader()
-	if err := engine.handshake(); err != nil {
+	if err := engine.handshake(options); err != nil {
 		engine.Close()
 		return nil, err
 	}
@@ -387,7 +387,7 @@ func (e *EngineProcess) Close() {
 	_ = e.cmd.Wait()
 }
 
-func (e *EngineProcess) handshake() error {
+func (e *EngineProcess) handshake(options []string) error {
 	e.mu.Lock()
 	defer e.mu.Unlock()
 	if err := e.sendLocked("uci"); err != nil {
@@ -396,6 +396,11 @@ func (e *EngineProcess) handshake() error {
 	if _, err := e.waitForPrefixLocked("uciok"); err != nil {
 		return err
 	}
+	for _, option := range options {
+		if err := e.sendLocked(option); err != nil {
+			return err
+		}
+	}
 	if err := e.sendLocked("isready"); err != nil {
 		return err
 	}
@@ -409,90 +414,115 @@ func (e *EngineProcess) NewGame() error {
 	return e.sendLocked("ucinewgame")
 }
 
-func (e *EngineProcess) LegalMoves(moves []string) ([]string, error) {
+// EngineState is the engine's summary of a position: its legal moves, FEN, whether the side
+// to move is in check and how the game stands.
+type EngineState struct {
+	LegalMoves []string
+	Fen        string
+	InCheck    bool
+	// One of none, checkmate, stalemate, fifty, repetition or material.
+	Result string
+}
+
+// GameOver reports whether the game has ended by mate or by a draw.
+func (st EngineState) GameOver() bool {
+	return st.Result != "none"
+}
+
+// State answers with everything the session needs after a move in one round trip.
+func (e *EngineProcess) State(moves []string) (EngineState, error) {
 	e.mu.Lock()
 	defer e.mu.Unlock()
 	if err := e.sendLocked(buildPositionCommand(moves)); err != nil {
-		return nil, err
+		return EngineState{}, err
 	}
-	if err := e.sendLocked("legalmoves"); err != nil {
-		return nil, err
+	if err := e.sendLocked("state"); err != nil {
+		return EngineState{}, err
 	}
-	line, err := e.waitForPrefixLocked("legalmoves")
+	line, err := e.waitForPrefixLocked("state ")
 	if err != nil {
-		return nil, err
+		return EngineState{}, err
 	}
+	return parseStateLine(line)
+}
+
+// parseStateLine reads "state result <r> incheck <0|1> fen <fen...> legalmoves <moves...>".
+func parseStateLine(line string) (EngineState, error) {
 	fields := strings.Fields(line)
-	if len(fields) <= 1 {
-		return nil, nil
+	fenIndex := -1
+	movesIndex := -1
+	for i, field := range fields {
+		if field == "fen" && fenIndex < 0 {
+			fenIndex = i
+		} else if field == "legalmoves" && movesIndex < 0 {
+			movesIndex = i
+		}
+	}
+	if len(fields) < 5 || fields[1] != "result" || fields[3] != "incheck" || fenIndex != 5 ||
+		movesIndex <= fenIndex {
+		return EngineState{}, errors.New("invalid state response")
 	}
-	return fields[1:], nil
+	return EngineState{
+		LegalMoves: append([]string(nil), fields[movesIndex+1:]...),
+		Fen:        strings.Join(fields[fenIndex+1:movesIndex], " "),
+		InCheck:    fields[4] == "1",
+		Result:     fields[2],
+	}, nil
 }
 
-func (e *EngineProcess) BestMove(moves []string, depth int, movetimeMs int) (string, error) {
+// BestMove returns the engine's move and the reply it expects, which is empty when the
+// engine gave none.
+func (e *EngineProcess) BestMove(moves []string, depth int, movetimeMs int) (string, string, error) {
 	e.mu.Lock()
 	defer e.mu.Unlock()
 	if err := e.sendLocked(buildPositionCommand(moves)); err != nil {
-		return "", err
+		return "", "", err
 	}
-	if movetimeMs > 0 {
-		if err := e.sendLocked(fmt.Sprintf("go movetime %d", movetimeMs)); err != nil {
-			return "", err
-		}
-	} else {
-		if err := e.sendLocked(fmt.Sprintf("go depth %d", depth)); err != nil {
-			return "", err
-		}
-	}
-	for {
-		line, err := e.readLineLocked()
-		if err != nil {
-			return "", err
-		}
-		if strings.HasPrefix(line, "bestmove ") {
-			parts := strings.Fields(line)
-			if len(parts) >= 2 {
-				return parts[1], nil
-			}
-			return "", nil
-		}
+	if err := e.sendLocked(buildGoCommand("go", depth, movetimeMs)); err != nil {
+		return "", "", err
 	}
+	return e.readBestMoveLocked()
 }
 
-func (e *EngineProcess) Fen(moves []string) (string, error) {
+// Ponder searches the position after moves while the player thinks. It must be ended with
+// FinishPonder before the engine is sent anything else.
+func (e *EngineProcess) Ponder(moves []string, depth int, movetimeMs int) error {
 	e.mu.Lock()
 	defer e.mu.Unlock()
 	if err := e.sendLocked(buildPositionCommand(moves)); err != nil {
-		return "", err
-	}
-	if err := e.sendLocked("fen"); err != nil {
-		return "", err
-	}
-	line, err := e.waitForPrefixLocked("fen ")
-	if err != nil {
-		return "", err
+		return err
 	}
-	return strings.TrimPrefix(line, "fen "), nil
+	return e.sendLocked(buildGoCommand("go ponder", depth, movetimeMs))
 }
 
-func (e *EngineProcess) InCheck(moves []string) (bool, error) {
+// FinishPonder sends ponderhit when the player made the predicted move, so the search goes
+// on with its own clock, and stop otherwise. Either way it returns the search's result.
+func (e *EngineProcess) FinishPonder(hit bool) (string, string, error) {
 	e.mu.Lock()
 	defer e.mu.Unlock()
-	if err := e.sendLocked(buildPositionCommand(moves)); err != nil {
-		return false, err
+	command := "stop"
+	if hit {
+		command = "ponderhit"
 	}
-	if err := e.sendLocked("incheck"); err != nil {
-		return false, err
+	if err := e.sendLocked(command); err != nil {
+		return "", "", err
 	}
-	line, err := e.waitForPrefixLocked("incheck")
+	return e.readBestMoveLocked()
+}
+
+func (e *EngineProcess) readBestMoveLocked() (string, string, error) {
+	line, err := e.waitForPrefixLocked("bestmove ")
 	if err != nil {
-		return false, err
+		return "", "", err
 	}
-	fields := strings.Fields(line)
-	if len(fields) < 2 {
-		return false, errors.New("invalid incheck response")
+	parts := strings.Fields(line)
+	if len(parts) < 2 {
+		return "", "", nil
 	}
-	return fields[1] == "1", nil
+	if len(parts) >= 4 && parts[2] == "ponder" {
+		return parts[1], parts[3], nil
+	}
+	return parts[1], "", nil
 }
 
 func (e *EngineProcess) sendLocked(command string) error {
@@ -525,6 +555,13 @@ func (e *EngineProcess) waitForPrefixLocked(prefix string) (string, error) {
 	}
 }
 
+func buildGoCommand(prefix string, depth int, movetimeMs int) string {
+	if movetimeMs > 0 {
+		return fmt.Sprintf("%s movetime %d", prefix, movetimeMs)
+	}
+	return fmt.Sprintf("%s depth %d", prefix, depth)
+}
+
 func buildPositionCommand(moves []string) string {
 	if len(moves) == 0 {
 		return "position startpos"
@@ -538,6 +575,45 @@ type Session struct {
 	depth         int
 	movetimeMs    int
 	playerIsWhite bool
+	ponder        bool
+	nextPonder    string
+	ponderMove    string
+	pondering     bool
+	// The engine's view of the position after moves, refreshed whenever moves change.
+	state EngineState
+}
+
+// StartPonder searches nextPonder, the reply the engine expects after its last move, on
+// the player's time. Nothing else may be sent
+// to the engine until FinishPonder.
+func (s *Session) StartPonder() error {
+	ponderMove := s.nextPonder
+	s.nextPonder = ""
+	if !s.ponder || ponderMove == "" {
+		return nil
+	}
+	moves := append(append([]string(nil), s.moves...), ponderMove)
+	if err := s.engine.Ponder(moves, s.depth, s.movetimeMs); err != nil {
+		return err
+	}
+	s.ponderMove = ponderMove
+	s.pondering = true
+	return nil
+}
+
+// FinishPonder ends any ponder search. When playerMove is the predicted reply it returns
+// the engine's answer to it and the reply it expects next.
+func (s *Session) FinishPonder(playerMove string) (string, string, error) {
+	if !s.pondering {
+		return "", "", nil
+	}
+	s.pondering = false
+	hit := playerMove != "" && playerMove == s.ponderMove
+	bestMove, ponderMove, err := s.engine.FinishPonder(hit)
+	if err != nil || !hit {
+		return "", "", err
+	}
+	return bestMove, ponderMove, nil
 }
 
 func sideToMoveIsWhite(moves []string) bool {
@@ -551,14 +627,21 @@ func sideToMoveIsPlayer(moves []string, playerIsWhite bool) bool {
 	return !sideToMoveIsWhite(moves)
 }
 
-func gameOverMessage(moves []string, playerIsWhite bool, inCheck bool) string {
-	if !inCheck {
-		return "Stalemate. Draw."
-	}
-	if sideToMoveIsPlayer(moves, playerIsWhite) {
-		return "Checkmate. Engine wins."
+func gameOverMessage(moves []string, playerIsWhite bool, state EngineState) string {
+	switch state.Result {
+	case "checkmate":
+		if sideToMoveIsPlayer(moves, playerIsWhite) {
+			return "Checkmate. Engine wins."
+		}
+		return "Checkmate. You win."
+	case "fifty":
+		return "Draw by the fifty-move rule."
+	case "repetition":
+		return "Draw by threefold repetition."
+	case "material":
+		return "Draw by insufficient material."
 	}
-	return "Checkmate. You win."
+	return "Stalemate. Draw."
 }
 
 func parsePlayerColor(value string, fallback bool) bool {
@@ -568,63 +651,57 @@ func parsePlayerColor(value string, fallback bool) bool {
 	return !strings.EqualFold(strings.TrimSpace(value), "black")
 }
 
+func (s *Session) refreshState() error {
+	state, err := s.engine.State(s.moves)
+	if err != nil {
+		return err
+	}
+	s.state = state
+	return nil
+}
+
 func (s *Session) Reset(playerIsWhite bool) (string, string, string, error) {
+	if _, _, err := s.FinishPonder(""); err != nil {
+		return "", "", "", err
+	}
 	s.moves = nil
 	s.playerIsWhite = playerIsWhite
+	s.nextPonder = ""
 	if err := s.engine.NewGame(); err != nil {
 		return "", "", "", err
 	}
+	if err := s.refreshState(); err != nil {
+		return "", "", "", err
+	}
 	if playerIsWhite {
 		return "Your move", "", "", nil
 	}
-
-	engineMoves, err := s.engine.LegalMoves(s.moves)
-	if err != nil {
-		return "", "", "", err
-	}
-	if len(engineMoves) == 0 {
-		inCheck, err := s.engine.InCheck(s.moves)
-		if err != nil {
-			return "", "", "", err
-		}
-		return "Game over", gameOverMessage(s.moves, s.playerIsWhite, inCheck), "", nil
+	if s.state.GameOver() {
+		return "Game over", gameOverMessage(s.moves, s.playerIsWhite, s.state), "", nil
 	}
 
-	bestMove, err := s.engine.BestMove(s.moves, s.depth, s.movetimeMs)
+	bestMove, ponderMove, err := s.engine.BestMove(s.moves, s.depth, s.movetimeMs)
 	if err != nil {
 		return "", "", "", err
 	}
 	if bestMove == "" || bestMove == "(none)" || bestMove == "0000" {
-		inCheck, err := s.engine.InCheck(s.moves)
-		if err != nil {
-			return "", "", "", err
-		}
-		return "Game over", gameOverMessage(s.moves, s.playerIsWhite, inCheck), "", nil
+		return "Game over", gameOverMessage(s.moves, s.playerIsWhite, s.state), "", nil
 	}
 	s.moves = append(s.moves, bestMove)
-
-	playerMoves, err := s.engine.LegalMoves(s.moves)
-	if err != nil {
+	if err := s.refreshState(); err != nil {
 		return "", "", "", err
 	}
-	if len(playerMoves) == 0 {
-		inCheck, err := s.engine.InCheck(s.moves)
-		if err != nil {
-			return "", "", "", err
-		}
-		return "Game over", gameOverMessage(s.moves, s.playerIsWhite, inCheck), bestMove, nil
+	if s.state.GameOver() {
+		return "Game over", gameOverMessage(s.moves, s.playerIsWhite, s.state), bestMove, nil
 	}
+	s.nextPonder = ponderMove
 	return "Your move", "", bestMove, nil
 }
 
 func (s *Session) SendState(ws *WsConn, status, engineMove, message string) error {
-	fen, err := s.engine.Fen(s.moves)
-	if err != nil {
-		return fmt.Errorf("%w: %w", errEngineFailure, err)
-	}
 	state := ServerMessage{
 		Type:       "state",
-		Fen:        fen,
+		Fen:        s.state.Fen,
 		Moves:      append([]string(nil), s.moves...),
 		EngineMove: engineMove,
 		Status:     status,
@@ -633,7 +710,7 @@ func (s *Session) SendState(ws *WsConn, status, engineMove, message string) erro
 	return ws.WriteJSON(state)
 }
 
-func handleSession(ws *WsConn, pool *EnginePool, enginePath string, depth int, movetimeMs int) {
+func handleSession(ws *WsConn, pool *EnginePool, enginePath string, options []string, depth int, movetimeMs int, ponder bool) {
 	defer ws.Close()
 
 	var engine *EngineProcess
@@ -641,7 +718,7 @@ func handleSession(ws *WsConn, pool *EnginePool, enginePath string, depth int, m
 	if pool != nil {
 		engine, err = pool.Acquire(engineAcquireTimeout)
 	} else {
-		engine, err = startEngine(enginePath)
+		engine, err = startEngine(enginePath, options)
 	}
 	if err != nil {
 		_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
@@ -663,7 +740,14 @@ func handleSession(ws *WsConn, pool *EnginePool, enginePath string, depth int, m
 		depth:         depth,
 		movetimeMs:    movetimeMs,
 		playerIsWhite: true,
+		ponder:        ponder,
 	}
+	// Runs before the engine goes back to the pool, which expects it idle.
+	defer func() {
+		if _, _, err := session.FinishPonder(""); err != nil {
+			healthy = false
+		}
+	}()
 	status, message, engineMove, err := session.Reset(true)
 	if err != nil {
 		healthy = false
@@ -672,9 +756,11 @@ func handleSession(ws *WsConn, pool *EnginePool, enginePath string, depth int, m
 	}
 
 	if err := session.SendState(ws, status, engineMove, message); err != nil {
-		if errors.Is(err, errEngineFailure) {
-			healthy = false
-		}
+		_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
+		return
+	}
+	if err := session.StartPonder(); err != nil {
+		healthy = false
 		_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
 		return
 	}
@@ -699,6 +785,10 @@ func handleSession(ws *WsConn, pool *EnginePool, enginePath string, depth int, m
 				continue
 			}
 			_ = session.SendState(ws, status, engineMove, message)
+			if err := session.StartPonder(); err != nil {
+				healthy = false
+				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
+			}
 		case "movetime":
 			value := msg.MovetimeMs
 			if value < 0 {
@@ -714,79 +804,70 @@ func handleSession(ws *WsConn, pool *EnginePool, enginePath string, depth int, m
 				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: "missing move"})
 				continue
 			}
-			legalMoves, err := session.engine.LegalMoves(session.moves)
+			// A correctly predicted move has its answer ready, searched on the player's time.
+			ponderedMove, ponderedReply, err := session.FinishPonder(uci)
 			if err != nil {
 				healthy = false
 				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
 				continue
 			}
-			if !containsMove(legalMoves, uci) {
+			if session.state.GameOver() {
+				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: "game over"})
+				continue
+			}
+			if !containsMove(session.state.LegalMoves, uci) {
 				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: "illegal move"})
 				continue
 			}
 			session.moves = append(session.moves, uci)
-			engineMoves, err := session.engine.LegalMoves(session.moves)
-			if err != nil {
+			if err := session.refreshState(); err != nil {
 				healthy = false
 				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
 				continue
 			}
-			if len(engineMoves) == 0 {
-				inCheck, err := session.engine.InCheck(session.moves)
-				if err != nil {
-					healthy = false
-					_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
-					continue
-				}
-				message := gameOverMessage(session.moves, session.playerIsWhite, inCheck)
+			if session.state.GameOver() {
+				message := gameOverMessage(session.moves, session.playerIsWhite, session.state)
 				_ = session.SendState(ws, "Game over", "", message)
 				continue
 			}
 
 			if err := session.SendState(ws, "Engine thinking", "", ""); err != nil {
-				if errors.Is(err, errEngineFailure) {
-					healthy = false
-				}
-				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
-				continue
-			}
-			bestMove, err := session.engine.BestMove(session.moves, session.depth, session.movetimeMs)
-			if err != nil {
-				healthy = false
 				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
 				continue
 			}
-			status := "Your move"
-			message := ""
-			if bestMove == "" || bestMove == "(none)" || bestMove == "0000" {
-				inCheck, err := session.engine.InCheck(session.moves)
+			bestMove, ponderMove := ponderedMove, ponderedReply
+			if bestMove == "" {
+				bestMove, ponderMove, err = session.engine.BestMove(session.moves, session.depth, session.movetimeMs)
 				if err != nil {
 					healthy = false
 					_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
 					continue
 				}
+			}
+			status := "Your move"
+			message := ""
+			if bestMove == "" || bestMove == "(none)" || bestMove == "0000" {
 				status = "Game over"
-				message = gameOverMessage(session.moves, session.playerIsWhite, inCheck)
+				message = gameOverMessage(session.moves, session.playerIsWhite, session.state)
 			} else {
 				session.moves = append(session.moves, bestMove)
-				playerMoves, err := session.engine.LegalMoves(session.moves)
-				if err != nil {
+				if err := session.refreshState(); err != nil {
 					healthy = false
 					_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
 					continue
 				}
-				if len(playerMoves) == 0 {
-					inCheck, err := session.engine.InCheck(session.moves)
-					if err != nil {
-						healthy = false
-						_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
-						continue
-					}
+				if session.state.GameOver() {
 					status = "Game over"
-					message = gameOverMessage(session.moves, session.playerIsWhite, inCheck)
+					message = gameOverMessage(session.moves, session.playerIsWhite, session.state)
+				} else {
+					session.nextPonder = ponderMove
 				}
 			}
 			_ = session.SendState(ws, status, bestMove, message)
+			if err := session.StartPonder(); err != nil {
+				healthy = false
+				_ = ws.WriteJSON(ServerMessage{Type: "error", Message: err.Error()})
+			}
 		default:
 			_ = ws.WriteJSON(ServerMessage{Type: "error", Message: "unknown command"})
 		}
@@ -820,12 +901,20 @@ func main() {
 	movetimeMs := flag.Int("movetime", 1000, "search time per move in ms (overrides depth when > 0)")
 	staticDir := flag.String("static", "static", "static file directory")
 	poolSize := flag.Int("pool", 1, "engine pool size (0 = disable pooling)")
+	sharedHash := flag.String("shared-hash", "", "shared-memory segment name for a hash table shared by all engines")
+	ponder := flag.Bool("ponder", true, "let the engine think on the player's time")
 	flag.Parse()
 
+	var engineOptions []string
+	if *sharedHash != "" {
+		engineOptions = append(engineOptions, "setoption name SharedHash value "+*sharedHash)
+		log.Printf("engine shared hash %s", *sharedHash)
+	}
+
 	var pool *EnginePool
 	if *poolSize > 0 {
 		var err error
-		pool, err = NewEnginePool(*enginePath, *poolSize)
+		pool, err = NewEnginePool(*enginePath, engineOptions, *poolSize)
 		if err != nil {
 			log.Fatal(err)
 		}
@@ -847,7 +936,7 @@ func main() {
 			http.Error(w, "websocket upgrade failed", http.StatusBadRequest)
 			return
 		}
-		go handleSession(ws, pool, *enginePath, *depth, *movetimeMs)
+		go handleSession(ws, pool, *enginePath, engineOptions, *depth, *movetimeMs, *ponder)
 	})
 
 	log.Printf("listening on http://%s", *addr)